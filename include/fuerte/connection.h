@@ -26,8 +26,10 @@
 #include "types.h"
 #include "connection_interface.h"
 
+#include <atomic>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace arangodb { namespace fuerte { inline namespace v1 {
 
@@ -35,6 +37,7 @@ class Database;
 
 class Connection : public std::enable_shared_from_this<Connection> {
   friend class ConnectionBuilder;
+  friend class ConnectionPool;
 
   public:
     ~Connection(){ FUERTE_LOG_DEBUG << "DESTROYING CONNECTION" << std::endl; }
@@ -66,6 +69,12 @@ class Connection : public std::enable_shared_from_this<Connection> {
       return _realConnection->requestsLeft();
     }
 
+    // abandons the request with the given id - its error callback is called
+    // with ErrorCondition::Canceled unless it has been completed before
+    void cancel(MessageID id){
+      _realConnection->cancel(id);
+    }
+
   private:
     Connection(detail::ConnectionConfiguration const& conf);
     std::shared_ptr<ConnectionInterface>  _realConnection;
@@ -73,6 +82,47 @@ class Connection : public std::enable_shared_from_this<Connection> {
 };
 
 
+// A ConnectionPool owns several vst connections to the same endpoint and
+// sends every request on the connection with the fewest outstanding
+// requests. Message ids are unique within the pool - the upper bits select
+// the connection.
+class ConnectionPool {
+  friend class ConnectionBuilder;
+
+  public:
+    std::unique_ptr<Response> sendRequest(std::unique_ptr<Request> r){
+      return next()->sendRequest(std::move(r));
+    }
+
+    std::unique_ptr<Response> sendRequest(Request const& r){
+      return next()->sendRequest(r);
+    }
+
+    // callback may be called in parallel - think about possible races!
+    MessageID sendRequest(std::unique_ptr<Request> r, OnErrorCallback e, OnSuccessCallback c){
+      return next()->sendRequest(std::move(r), e, c);
+    }
+
+    MessageID sendRequest(Request const& r, OnErrorCallback e, OnSuccessCallback c){
+      return next()->sendRequest(r, e, c);
+    }
+
+    std::size_t requestsLeft();
+    void cancel(MessageID id);
+    std::size_t size() const { return _connections.size(); }
+
+  private:
+    static constexpr unsigned connectionIdShift = 48;
+
+    ConnectionPool(detail::ConnectionConfiguration const& conf, std::size_t size);
+    // connection with the fewest queued and in-flight requests
+    std::shared_ptr<Connection> const& next();
+
+    std::vector<std::shared_ptr<Connection>> _connections;
+    std::atomic_size_t _start; // rotates the first candidate to spread ties
+};
+
+
 /** The connection Builder is a class that allows the easy configuration of
  *  connections. We decided to use the builder pattern because the connections
  *  have too many options to put them all in a single constructor. When you have
@@ -84,6 +134,7 @@ class ConnectionBuilder {
   public:
     ConnectionBuilder& host(std::string const&); // takes url in the form  (http|vst)[s]://(ip|hostname):port
                                                  // sets protocol host and port
+    ConnectionBuilder& addHost(std::string const&); // failover host (vst and asio http) - same url form and protocol as host()
     //ConnectionBuilder() = delete;
     //ConnectionBuilder(std::string const& s){
     //  host(s);
@@ -93,10 +144,62 @@ class ConnectionBuilder {
       return std::shared_ptr<Connection>( new Connection(_conf)) ;
     }
 
+    // creates a pool of size vst connections with the current options
+    std::shared_ptr<ConnectionPool> connectPool(std::size_t size){
+      return std::shared_ptr<ConnectionPool>( new ConnectionPool(_conf, size)) ;
+    }
+
     ConnectionBuilder& async(bool b){ _conf._async = b; return *this; }
     ConnectionBuilder& user(std::string const& u){ _conf._user = u; return *this; }
     ConnectionBuilder& password(std::string const& p){ _conf._password = p; return *this; }
     ConnectionBuilder& maxChunkSize(std::size_t c){ _conf._maxChunkSize = c; return *this; }
+    // capacity of the vst receive buffer - grows temporarily for larger chunks
+    ConnectionBuilder& receiveBufferSize(std::size_t s){ _conf._receiveBufferSize = s; return *this; }
+    // vst responses announcing a larger message fail with VstReadError -
+    // a larger chunk resets the connection
+    ConnectionBuilder& maxMessageSize(std::size_t s){ _conf._maxMessageSize = s; return *this; }
+    // default for requests that do not set their own timeout
+    ConnectionBuilder& requestTimeout(std::chrono::milliseconds t){ _conf._requestTimeout = t; return *this; }
+    // limit for each attempt to connect to a single address
+    ConnectionBuilder& connectTimeout(std::chrono::milliseconds t){ _conf._connectTimeout = t; return *this; }
+    // VST 1.1 requires ArangoDB 3.2 or later
+    ConnectionBuilder& vstVersion(VstVersion v){ _conf._vstVersion = v; return *this; }
+    // limits the requests of a vst connection that have not been completed -
+    // a single request is always accepted, even if it exceeds the bytes limit
+    ConnectionBuilder& maxInFlight(std::size_t requests, std::size_t bytes = 0){
+      _conf._maxInFlightRequests = requests;
+      _conf._maxInFlightBytes = bytes;
+      return *this;
+    }
+    // Block must not be used when requests are sent from callbacks,
+    // these run on the threads that complete requests
+    ConnectionBuilder& backpressure(BackpressurePolicy p, OnReadyCallback onReady = nullptr){
+      _conf._backpressurePolicy = p;
+      _conf._onReady = onReady;
+      return *this;
+    }
+    // lowers the number of requests in flight when the latency of the server
+    // rises or requests time out and raises it again while the latency is
+    // stable - maxInFlight() sets the upper bound and the initial limit
+    // (otherwise it starts at 8). Http connections of a loop share a limit
+    // per server.
+    ConnectionBuilder& adaptiveInFlight(bool a){ _conf._adaptiveInFlight = a; return *this; }
+    // only used for http connections - the asio backend keeps one connection
+    // to the server and pipelines the requests
+    ConnectionBuilder& httpBackend(HttpBackend b){ _conf._httpBackend = b; return *this; }
+    // limits the connections of the curl backend - these are shared by all
+    // http connections of a loop, the last connection created sets them
+    ConnectionBuilder& httpConnectionLimits(std::size_t perHost, std::size_t total = 0){
+      _conf._maxHostConnections = perHost;
+      _conf._maxTotalConnections = total;
+      return *this;
+    }
+    // retries (with exponential backoff) when no host can be reached
+    ConnectionBuilder& reconnect(unsigned attempts, std::chrono::milliseconds delay){
+      _conf._reconnectAttempts = attempts;
+      _conf._reconnectDelay = delay;
+      return *this;
+    }
 
   private:
     detail::ConnectionConfiguration _conf;
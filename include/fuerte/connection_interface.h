@@ -37,6 +37,9 @@ public:
   virtual std::unique_ptr<Response> sendRequest(std::unique_ptr<Request>) = 0;
   virtual MessageID sendRequest(std::unique_ptr<Request>, OnErrorCallback, OnSuccessCallback) = 0;
   virtual std::size_t requestsLeft() = 0;
+  // abandons a request - its error callback is called with
+  // ErrorCondition::Canceled unless it has been completed before
+  virtual void cancel(MessageID) = 0;
   virtual void start(){}
   virtual void restart(){}
 };
@@ -47,6 +47,7 @@ namespace vst {
 
 namespace http{
   class HttpCommunicator;
+  class AsioHttpConnection;
 }
 
 // need partial rewrite so it can be better integrated in client applications
@@ -93,6 +94,7 @@ private:
 class Loop{
   friend class LoopProvider;
   friend class vst::VstConnection;
+  friend class http::AsioHttpConnection;
 
 public:
   Loop();
@@ -26,9 +26,11 @@
 #include "types.h"
 
 #include <boost/optional.hpp>
+#include <chrono>
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
 
 namespace arangodb { namespace fuerte { inline namespace v1 {
 
@@ -122,6 +124,10 @@ public:
   void addVPack(VBuffer&& buffer);
   void addBinary(uint8_t const* data, std::size_t length);
   void addBinarySingle(VBuffer&& buffer);
+  // take shared ownership of length bytes at data instead of copying them
+  // (data may alias into a larger buffer - see shared_ptr aliasing constructor)
+  void addVPack(std::shared_ptr<uint8_t const> data, std::size_t length);
+  void addBinarySingle(std::shared_ptr<uint8_t const> data, std::size_t length);
 
   ///////////////////////////////////////////////
   // get payload
@@ -149,6 +155,7 @@ public:
 
 private:
   VBuffer _payload;
+  std::shared_ptr<uint8_t const> _sharedPayload; // used instead of _payload if set
   bool _sealed;
   bool _modified;
   ::boost::optional<bool> _isVpack;
@@ -163,18 +170,47 @@ public:
   Request(MessageHeader&& messageHeader = MessageHeader()
          ,mapss&& headerStrings = mapss()
          ): Message(std::move(messageHeader), std::move(headerStrings))
+         ,_timeout(0)
+         ,_idempotent(false)
          {
            header.type = MessageType::Request;
          }
   Request(MessageHeader const& messageHeader
          ,mapss const& headerStrings
          ): Message(messageHeader, headerStrings)
+         ,_timeout(0)
+         ,_idempotent(false)
          {
            header.type = MessageType::Request;
          }
 
+  // time after which the request fails with ErrorCondition::Timeout
+  // zero means the default of the connection is used
+  std::chrono::milliseconds timeout() const { return _timeout; }
+  void timeout(std::chrono::milliseconds timeout){ _timeout = timeout; }
+
+  // idempotent requests are sent again when the connection is reset
+  // after they have been written - GET and HEAD requests always are
+  bool idempotent() const {
+    return _idempotent || header.restVerb == RestVerb::Get || header.restVerb == RestVerb::Head;
+  }
+  void idempotent(bool idempotent){ _idempotent = idempotent; }
+
+  // streams the response body (vst only): the callback receives the body in
+  // parts as the chunks arrive and the success callback gets a response
+  // without payload - the body is never assembled in memory
+  OnChunkCallback const& onChunk() const { return _onChunk; }
+  void onChunk(OnChunkCallback onChunk){ _onChunk = std::move(onChunk); }
+
+private:
+  std::chrono::milliseconds _timeout;
+  bool _idempotent;
+  OnChunkCallback _onChunk;
 };
 
+// The payload of a response may reference the buffer it has been received
+// in, together with other data of the connection (see VstConnection). Copy
+// the slices of a response that is kept for long to release that buffer.
 class Response : public Message {
 public:
   Response(MessageHeader&& messageHeader = MessageHeader()
@@ -89,5 +89,11 @@ createRequest(RestVerb verb
              ,std::string const& path
              ,mapss const& parameter = mapss()
              );
+
+// vst authentication message (plain)
+std::unique_ptr<Request>
+createAuthenticationRequest(std::string const& user
+                           ,std::string const& password
+                           );
 }}}
 #endif
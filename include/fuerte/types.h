@@ -28,9 +28,11 @@
 #include <velocypack/Buffer.h>
 #include <velocypack/Builder.h>
 
+#include <chrono>
 #include <map>
 #include <vector>
 #include <string>
+#include <utility>
 #include <cassert>
 #include <algorithm>
 
@@ -45,6 +47,10 @@ using Ticket = MessageID;
 
 using OnSuccessCallback = std::function<void(std::unique_ptr<Request>, std::unique_ptr<Response>)>;
 using OnErrorCallback = std::function<void(Error, std::unique_ptr<Request>, std::unique_ptr<Response>)>;
+// receives the response body of a request in parts as they arrive
+using OnChunkCallback = std::function<void(MessageID, uint8_t const* data, std::size_t length)>;
+// called when a connection that rejected requests accepts new ones
+using OnReadyCallback = std::function<void()>;
 
 using VBuffer = arangodb::velocypack::Buffer<uint8_t>;
 using VSlice = arangodb::velocypack::Slice;
@@ -73,9 +79,12 @@ enum class ErrorCondition : Error {
   ConnectionError = 1000,
   CouldNotConnect = 1001,
   Timeout = 1002,
+  Canceled = 1003,
+  QueueFull = 1004,
   VstReadError = 1102,
   VstWriteError =1103,
   VstCanceldDuringReset = 1104,
+  VstUnauthorized = 1105,
 
   CurlError = 3000,
 
@@ -126,6 +135,22 @@ std::string to_string(MessageType type);
 enum class TransportType { Undefined = 0, Http = 1, Vst = 2 };
 std::string to_string(TransportType type);
 
+// VelocyStream protocol version - the value is used as vstVersionID
+enum class VstVersion { V1_0 = 1, V1_1 = 2 };
+
+// behaviour of sendRequest when a connection has reached its limits
+enum class BackpressurePolicy {
+  Block,  // wait until enough requests have been completed
+  Fail,   // fail the request with ErrorCondition::QueueFull
+  Notify  // like Fail - the ready callback is called once there is room again
+};
+
+// implementation of http connections
+enum class HttpBackend {
+  Curl, // libcurl multi handle shared by all connections
+  Asio  // keep-alive connection with pipelining on the asio loop
+};
+
 // -----------------------------------------------------------------------------
 // --SECTION--                                                       ContentType
 // -----------------------------------------------------------------------------
@@ -145,9 +170,24 @@ namespace detail {
       , _ssl(true)
       , _async(false)
       , _host("localhost")
-      , _user("root")
-      , _password("foppels")
+      , _user() // no authentication
+      , _password()
       , _maxChunkSize(5000ul) // in bytes
+      , _receiveBufferSize(64 * 1024ul) // in bytes
+      , _maxMessageSize(256 * 1024 * 1024ul) // in bytes
+      , _requestTimeout(120000) // 0 disables timeouts
+      , _messageIdBase(0)
+      , _connectTimeout(5000)
+      , _reconnectAttempts(3)
+      , _reconnectDelay(100)
+      , _vstVersion(VstVersion::V1_0)
+      , _maxInFlightRequests(0)
+      , _maxInFlightBytes(0)
+      , _backpressurePolicy(BackpressurePolicy::Block)
+      , _adaptiveInFlight(false)
+      , _httpBackend(HttpBackend::Curl)
+      , _maxHostConnections(0)
+      , _maxTotalConnections(0)
       {}
 
     TransportType _connType; // vst or http
@@ -158,6 +198,23 @@ namespace detail {
     std::string _user;
     std::string _password;
     std::size_t _maxChunkSize;
+    std::size_t _receiveBufferSize;
+    std::size_t _maxMessageSize; // of received vst messages
+    std::chrono::milliseconds _requestTimeout;
+    uint64_t _messageIdBase; // vst message ids start after this value
+    std::vector<std::pair<std::string,std::string>> _failoverHosts; // host, port
+    std::chrono::milliseconds _connectTimeout; // per address
+    unsigned _reconnectAttempts; // rounds over all hosts after the first one failed
+    std::chrono::milliseconds _reconnectDelay; // before the first retry - doubled for every further retry
+    VstVersion _vstVersion;
+    std::size_t _maxInFlightRequests; // per connection - 0 disables the limit
+    std::size_t _maxInFlightBytes;    // encoded size of the requests in flight - 0 disables the limit
+    BackpressurePolicy _backpressurePolicy;
+    OnReadyCallback _onReady;
+    bool _adaptiveInFlight; // adapt the requests in flight to the latency - up to _maxInFlightRequests
+    HttpBackend _httpBackend;
+    std::size_t _maxHostConnections;  // curl connections per host - 0 disables the limit
+    std::size_t _maxTotalConnections; // curl connections in total - 0 disables the limit
   };
 
 }
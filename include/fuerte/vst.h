@@ -25,6 +25,7 @@
 
 #include "types.h"
 
+#include <map>
 #include <string>
 #include <memory>
 #include <stdexcept>
@@ -89,16 +90,22 @@ struct ChunkHeader {
   }
 };
 
+// VST 1.0 sends the total message length only in the first chunk of multi
+// chunk messages, VST 1.1 sends it in every chunk
 inline constexpr std::size_t chunkHeaderLength(int version, bool isFirst, bool isSingle){
   // until there is the next version we should use c++14 :P
   return (version == 1) ?
     sizeof(ChunkHeader::_chunkLength) + sizeof(ChunkHeader::_chunk) +
     sizeof(ChunkHeader::_messageID) + (isFirst && !isSingle ? sizeof(ChunkHeader::_totalMessageLength) : 0)
     :
-    sizeof(ChunkHeader::_chunkLength) + sizeof(ChunkHeader::_chunk) + sizeof(ChunkHeader::_messageID)
+    sizeof(ChunkHeader::_chunkLength) + sizeof(ChunkHeader::_chunk) +
+    sizeof(ChunkHeader::_messageID) + sizeof(ChunkHeader::_totalMessageLength)
     ;
 }
 
+// protocol preamble sent before the first chunk of a connection
+std::string const& preamble(int vstVersionID);
+
 // Item that represents a Request in flight
 struct RequestItem {
   std::unique_ptr<Request> _request;
@@ -106,10 +113,40 @@ struct RequestItem {
   OnSuccessCallback _onSuccess;
   MessageID _messageId;
   std::shared_ptr<VBuffer> _requestBuffer;
-  VBuffer _responseBuffer;
-  uint32_t _responseLength;    // length of complete message in bytes
-  std::size_t _responseChunks; // number of chunks in response
-  std::size_t _responseChunk;  // nuber of current chunk
+  std::size_t _requestBufferOffset = 0; // bytes of _requestBuffer already written
+  uint64_t _timeoutTick = 0;             // tick in the connection's timer wheel - 0 if none
+  bool _idempotent = false;              // may be sent again after a connection reset
+  bool _written = false;                 // completely written - guarded by the connection's replay mutex
+  bool _admitted = false;                // counted against the connection's limits
+  std::size_t _requestLength = 0;        // encoded size
+  std::chrono::steady_clock::time_point _sendTime; // admission - for latency measurements
+  OnChunkCallback _onChunk;              // set if the response body is streamed
+  std::size_t _responseHeaderLength = 0; // of a streamed response - 0 until it is known
+  VBuffer _responseBuffer;     // assembles the chunks of multi chunk responses
+  std::shared_ptr<uint8_t const> _responseData; // complete response message
+  uint32_t _responseLength = 0;    // length of complete message in bytes
+  std::size_t _responseChunks = 0; // number of chunks in response - 0 until the first chunk is known
+  std::size_t _responseChunk = 0;  // number of chunks received
+  std::size_t _responsePlaced = 0;       // leading chunks copied to _responseBuffer
+  std::size_t _responsePlacedLength = 0; // their payload length - the offset of the next chunk
+  std::map<std::size_t, std::vector<uint8_t>> _responsePending; // chunks ahead of their predecessors by index
+
+  // a request may be sent again after a reset unless part of its streamed
+  // body has been handed to the callback already - it would see it twice
+  bool replayable() const {
+    return _idempotent && !(_onChunk && _responseChunk);
+  }
+
+  // drops a partially received response (the request is sent again)
+  void resetResponse(){
+    _responseBuffer.clear();
+    _responseHeaderLength = 0;
+    _responseChunks = 0;
+    _responseChunk = 0;
+    _responsePlaced = 0;
+    _responsePlacedLength = 0;
+    _responsePending.clear();
+  }
 };
 
 /////////////////////////////////////////////////////////////////////////////////////
@@ -117,8 +154,10 @@ struct RequestItem {
 /////////////////////////////////////////////////////////////////////////////////////
 
 // creates a buffer in a shared pointer containg the message read to be send
-// out as vst (ChunkHeader, Header, Payload)
-std::shared_ptr<VBuffer> toNetwork(Request&);
+// out as vst (ChunkHeader, Header, Payload). Messages that do not fit into
+// maxChunkSize bytes (chunk header included) are split into multiple chunks
+// that are stored back to back in the buffer.
+std::shared_ptr<VBuffer> toNetwork(Request&, std::size_t maxChunkSize, int vstVersionID = 1);
 
 /////////////////////////////////////////////////////////////////////////////////////
 // receive vst
@@ -131,6 +170,10 @@ std::size_t isChunkComplete(uint8_t const * const begin, std::size_t const lengt
 // If there is a complete VstChunk you can use this function to read the header
 // a version 1.0 Header into a data structure
 ChunkHeader readChunkHeaderV1_0(uint8_t const * const bufferBegin);
+// a version 1.1 Header - the total message length is part of every chunk
+ChunkHeader readChunkHeaderV1_1(uint8_t const * const bufferBegin);
+// reads the header of the given protocol version
+ChunkHeader readChunkHeader(int vstVersionID, uint8_t const * const bufferBegin);
 
 // creates a MessageHeader form a given slice
 MessageHeader messageHeaderFromSlice(VSlice const& headerSlice);
@@ -0,0 +1,837 @@
+////////////////////////////////////////////////////////////////////////////////
+/// DISCLAIMER
+///
+/// Copyright 2016 ArangoDB GmbH, Cologne, Germany
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+///
+/// Copyright holder is ArangoDB GmbH, Cologne, Germany
+///
+/// @author Jan Christoph Uhde
+////////////////////////////////////////////////////////////////////////////////
+
+#include "AsioHttpConnection.h"
+#include <boost/asio/connect.hpp>
+#include <boost/asio/write.hpp>
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <fuerte/FuerteLogger.h>
+#include <fuerte/helper.h>
+#include <fuerte/loop.h>
+#include <fuerte/message.h>
+
+namespace arangodb { namespace fuerte { inline namespace v1 { namespace http {
+
+using namespace arangodb::fuerte::detail;
+
+namespace ba = ::boost::asio;
+namespace bs = ::boost::asio::ssl;
+using bt = ::boost::asio::ip::tcp;
+using BoostEC = ::boost::system::error_code;
+using Clock = std::chrono::steady_clock;
+using ItemSP = std::shared_ptr<HttpRequestItem>;
+typedef std::unique_ptr<Request> RequestUP;
+typedef std::unique_ptr<Response> ResponseUP;
+
+constexpr std::size_t AsioHttpConnection::maxWriteBatchSize;
+
+// limit for the status line and header fields of a response and
+// for the size line of a chunk
+static std::size_t const maxHeaderSize = 1024 * 1024;
+static char const crlf[] = "\r\n";
+static char const headerEnd[] = "\r\n\r\n";
+
+static std::string toLower(std::string str){
+  std::transform(str.begin(), str.end(), str.begin(), ::tolower);
+  return str;
+}
+
+AsioHttpConnection::AsioHttpConnection(ConnectionConfiguration const& configuration)
+    : _asioLoop(getProvider().getAsioLoop())
+    , _configuration(configuration)
+    , _messageId(0)
+    , _requestsLeft(0)
+    , _ioService(_asioLoop->getIoService())
+    , _strand(*_ioService)
+    , _resolver(*_ioService)
+    , _context(bs::context::method::sslv23)
+    , _connectTimer(*_ioService)
+    , _hostIndex(0)
+    , _reconnectAttempt(0)
+    , _generation(0)
+    , _connecting(false)
+    , _connected(false)
+    , _writing(false)
+    , _reading(false)
+    , _receiveBuffer(configuration._receiveBufferSize)
+    , _receiveBegin(0)
+    , _receiveEnd(0)
+    , _parseState(ParseState::Header)
+    , _bodyLeft(0)
+    , _closeAfterResponse(false)
+    , _timer(*_ioService)
+    , _timerExpiry(Clock::time_point::max())
+    {
+      _hosts.emplace_back(configuration._host, configuration._port);
+      _hosts.insert(_hosts.end(), configuration._failoverHosts.begin(), configuration._failoverHosts.end());
+    }
+
+AsioHttpConnection::~AsioHttpConnection(){
+  // a pending read only holds a weak reference
+  closeSocket();
+}
+
+MessageID AsioHttpConnection::sendRequest(RequestUP request
+                                         ,OnErrorCallback onError
+                                         ,OnSuccessCallback onSuccess){
+  request->messageid = ++_messageId;
+  auto item = std::make_shared<HttpRequestItem>();
+  item->_messageId = request->messageid;
+  item->_onError = onError;
+  item->_onSuccess = onSuccess;
+  item->_idempotent = request->idempotent();
+  item->_head = request->header.restVerb && request->header.restVerb.get() == RestVerb::Head;
+  buildHeader(*request, *item);
+  auto timeout = request->timeout();
+  if(timeout == std::chrono::milliseconds(0)){
+    timeout = _configuration._requestTimeout;
+  }
+  item->_deadline = timeout > std::chrono::milliseconds(0) ? Clock::now() + timeout : Clock::time_point::max();
+  item->_request = std::move(request);
+  MessageID messageId = item->_messageId;
+
+  ++_requestsLeft;
+  auto self = shared_from_this();
+  _strand.post([this,self,item](){
+    _queue.push_back(item);
+    armTimer(item->_deadline);
+    startWrite();
+  });
+  return messageId;
+}
+
+std::unique_ptr<Response> AsioHttpConnection::sendRequest(RequestUP request){
+  FUERTE_LOG_HTTPTRACE << "start sync request" << std::endl;
+  // we expect the loop to be running - it is run here otherwise
+  std::mutex mutex;
+  std::condition_variable conditionVar;
+  bool done = false;
+
+  auto rv = std::unique_ptr<Response>(nullptr);
+  auto onError  = [&](::arangodb::fuerte::v1::Error, RequestUP, ResponseUP response){
+    std::lock_guard<std::mutex> lock(mutex);
+    rv = std::move(response);
+    done = true;
+    conditionVar.notify_one();
+  };
+
+  auto onSuccess  = [&](RequestUP, ResponseUP response){
+    std::lock_guard<std::mutex> lock(mutex);
+    rv = std::move(response);
+    done = true;
+    conditionVar.notify_one();
+  };
+
+  sendRequest(std::move(request),onError,onSuccess);
+  if(!_asioLoop->_running){
+    arangodb::fuerte::run();
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  conditionVar.wait(lock, [&]{ return done; });
+  return rv;
+}
+
+void AsioHttpConnection::cancel(MessageID id){
+  auto self = shared_from_this();
+  _strand.post([this,self,id](){
+    auto queued = std::find_if(_queue.begin(), _queue.end(), [id](ItemSP const& item){ return item->_messageId == id; });
+    if(queued != _queue.end()){
+      ItemSP item = std::move(*queued);
+      _queue.erase(queued);
+      fail(*item, ErrorCondition::Canceled);
+      return;
+    }
+    // a written request keeps its place - the response is dropped
+    for(auto& item : _inFlight){
+      if(item->_messageId == id){
+        fail(*item, ErrorCondition::Canceled);
+        return;
+      }
+    }
+  });
+}
+
+void AsioHttpConnection::buildHeader(Request const& request, HttpRequestItem& item) const {
+  if(!request.header.restVerb || request.header.restVerb.get() == RestVerb::Illegal){
+    throw std::runtime_error("invalid request type");
+  }
+  RestVerb verb = request.header.restVerb.get();
+  std::string& header = item._requestLine;
+  header.reserve(128);
+  std::string verbString = to_string(verb);
+  std::transform(verbString.begin(), verbString.end(), verbString.begin(), ::toupper);
+  header.append(verbString);
+  header.push_back(' ');
+  if(request.header.database){
+    header.append("/_db/").append(request.header.database.get());
+  }
+  header.append(request.header.path ? request.header.path.get() : std::string("/"));
+
+  auto const& parameter = request.header.parameter;
+  if(parameter && !parameter.get().empty()){
+    char separator = '?';
+    for(auto const& p : parameter.get()){
+      header.push_back(separator);
+      header.append(urlEncode(p.first)).push_back('=');
+      header.append(urlEncode(p.second));
+      separator = '&';
+    }
+  }
+
+  header.append(" HTTP/1.1\r\n");
+
+  // the Host field depends on the host the connection reaches
+  std::string& fields = item._requestFields;
+  if(request.header.meta){
+    for(auto const& field : request.header.meta.get()){
+      std::string key = toLower(field.first);
+      if(key == "content-length" || key == "host"){
+        continue; // set by the connection
+      }
+      fields.append(field.first).append(": ").append(field.second).append(crlf);
+    }
+  }
+
+  std::size_t payloadLength = request.payload().second;
+  if(payloadLength || verb == RestVerb::Post || verb == RestVerb::Put || verb == RestVerb::Patch){
+    fields.append("Content-Length: ").append(std::to_string(payloadLength)).append(crlf);
+  }
+  fields.append(crlf);
+}
+
+// CONNECTING /////////////////////////////////////////////////////////////////
+
+void AsioHttpConnection::startConnect(){
+  _connecting = true;
+  _hostIndex = 0;
+  _reconnectAttempt = 0;
+  startResolve();
+}
+
+void AsioHttpConnection::startResolve(){
+  uint64_t generation = ++_generation;
+  auto self = shared_from_this();
+  if(_hostIndex == _hosts.size()){
+    if(_reconnectAttempt < _configuration._reconnectAttempts){
+      auto delay = _configuration._reconnectDelay * (1u << std::min(_reconnectAttempt, 16u));
+      ++_reconnectAttempt;
+      FUERTE_LOG_ERROR << "unable to connect to any host - retrying in " << delay.count() << "ms" << std::endl;
+      _connectTimer.expires_from_now(delay);
+      _connectTimer.async_wait(_strand.wrap([this,self,generation](BoostEC const& error){
+        if(!error && generation == _generation){
+          _hostIndex = 0;
+          startResolve();
+        }
+      }));
+      return;
+    }
+    FUERTE_LOG_ERROR << "unable to connect to any host" << std::endl;
+    failQueued(ErrorCondition::CouldNotConnect);
+    return;
+  }
+
+  auto const& host = _hosts[_hostIndex];
+  _resolver.async_resolve(bt::resolver::query(host.first, host.second)
+                         ,_strand.wrap([this,self,generation](BoostEC const& error, bt::resolver::iterator it){
+    if(generation != _generation){
+      return;
+    }
+    auto const& host = _hosts[_hostIndex];
+    if(error){
+      FUERTE_LOG_ERROR << "unable to resolve " << host.first << " -- " << error.message() << std::endl;
+      nextHost();
+      return;
+    }
+    _socket = std::make_shared<bt::socket>(*_ioService);
+    if(_configuration._ssl){
+      _sslSocket = std::make_shared<bs::stream<bt::socket&>>(*_socket, _context);
+      SSL_set_tlsext_host_name(_sslSocket->native_handle(), host.first.c_str());
+    }
+    auto socket = _socket;
+    _connectTimer.expires_from_now(_configuration._connectTimeout);
+    _connectTimer.async_wait(_strand.wrap([this,self,socket,generation](BoostEC const& error){
+      if(!error && generation == _generation && !_connected){
+        FUERTE_LOG_DEBUG << "connect timeout" << std::endl;
+        BoostEC ec;
+        socket->close(ec); // the connect fails with operation_aborted
+      }
+    }));
+    ba::async_connect(*_socket, it, _strand.wrap([this,self,socket,generation](BoostEC const& error, bt::resolver::iterator){
+      handleConnect(error, generation);
+    }));
+  }));
+}
+
+void AsioHttpConnection::handleConnect(BoostEC const& error, uint64_t generation){
+  if(generation != _generation){
+    return;
+  }
+  if(error){
+    FUERTE_LOG_ERROR << "unable to connect to " << _hosts[_hostIndex].first << " -- " << error.message() << std::endl;
+    nextHost();
+    return;
+  }
+  BoostEC ec;
+  _socket->set_option(bt::no_delay(true), ec); // requests are pipelined
+  if(!_configuration._ssl){
+    finishConnect();
+    return;
+  }
+  auto self = shared_from_this();
+  auto socket = _socket;
+  auto sslSocket = _sslSocket;
+  _sslSocket->async_handshake(bs::stream_base::client
+                             ,_strand.wrap([this,self,socket,sslSocket,generation](BoostEC const& error){
+    if(generation != _generation){
+      return;
+    }
+    if(error){
+      FUERTE_LOG_ERROR << "unable to perform ssl handshake -- " << error.message() << std::endl;
+      nextHost();
+      return;
+    }
+    finishConnect();
+  }));
+}
+
+void AsioHttpConnection::nextHost(){
+  closeSocket();
+  ++_hostIndex;
+  startResolve();
+}
+
+void AsioHttpConnection::finishConnect(){
+  _connectTimer.cancel();
+  _connecting = false;
+  _connected = true;
+  auto const& host = _hosts[_hostIndex];
+  _hostField = std::make_shared<std::string>("Host: " + host.first + ":" + host.second + crlf);
+  FUERTE_LOG_DEBUG << "http connection established" << std::endl;
+  startRead();
+  startWrite();
+}
+
+void AsioHttpConnection::closeSocket(){
+  _connectTimer.cancel();
+  if(!_socket){
+    return;
+  }
+  // no close_notify - pending operations end with an error
+  BoostEC error;
+  _socket->shutdown(bt::socket::shutdown_both, error);
+  _socket->close(error);
+  _sslSocket = nullptr;
+  _socket = nullptr;
+}
+
+void AsioHttpConnection::resetConnection(){
+  ++_generation;
+  closeSocket();
+  _connecting = false;
+  _connected = false;
+  _writing = false;
+  _reading = false;
+  _receiveBegin = _receiveEnd = 0;
+  _parseState = ParseState::Header;
+  _response = nullptr;
+  _body.clear();
+  _closeAfterResponse = false;
+
+  // the responses of the written requests are lost
+  std::vector<ItemSP> replay;
+  for(auto& item : _inFlight){
+    if(item->_completed){
+      continue;
+    }
+    if(item->_idempotent){
+      replay.push_back(std::move(item));
+    } else {
+      fail(*item, ErrorCondition::ConnectionError);
+    }
+  }
+  _inFlight.clear();
+  _queue.insert(_queue.begin(), replay.begin(), replay.end());
+  if(!_queue.empty()){
+    startConnect();
+  }
+}
+
+void AsioHttpConnection::failQueued(ErrorCondition error){
+  ++_generation;
+  closeSocket();
+  _connecting = false;
+  std::deque<ItemSP> queue;
+  queue.swap(_queue);
+  for(auto& item : queue){
+    fail(*item, error);
+  }
+}
+
+// WRITING / READING //////////////////////////////////////////////////////////
+
+void AsioHttpConnection::startWrite(){
+  if(_writing || _queue.empty()){
+    return;
+  }
+  if(!_connected){
+    if(!_connecting){
+      startConnect();
+    }
+    return;
+  }
+  if(_inFlight.empty() && closedWhileIdle()){
+    // e.g. the keep-alive timeout of the server - requests that can not be
+    // sent again must not be written to the closed connection
+    FUERTE_LOG_DEBUG << "http connection closed while idle" << std::endl;
+    resetConnection();
+    return;
+  }
+
+  // pipeline all queued requests - the batch and the host field keep the
+  // buffers alive
+  auto batch = std::make_shared<std::vector<ItemSP>>();
+  auto hostField = _hostField;
+  auto buffers = std::make_shared<std::vector<ba::const_buffer>>();
+  std::size_t bytes = 0;
+  while(!_queue.empty() && (batch->empty() || bytes < maxWriteBatchSize)){
+    ItemSP item = std::move(_queue.front());
+    _queue.pop_front();
+    if(item->_completed){
+      continue; // canceled or timed out before it has been written
+    }
+    auto payload = item->_request->payload();
+    buffers->push_back(ba::buffer(item->_requestLine));
+    buffers->push_back(ba::buffer(*hostField));
+    buffers->push_back(ba::buffer(item->_requestFields));
+    if(payload.second){
+      buffers->push_back(ba::buffer(payload.first, payload.second));
+    }
+    bytes += item->_requestLine.size() + hostField->size() + item->_requestFields.size() + payload.second;
+    ++item->_writes;
+    _inFlight.push_back(item);
+    batch->push_back(std::move(item));
+  }
+  if(batch->empty()){
+    return;
+  }
+
+  _writing = true;
+  auto self = shared_from_this();
+  auto socket = _socket;
+  auto sslSocket = _sslSocket;
+  uint64_t generation = _generation;
+  auto handler = _strand.wrap([this,self,socket,sslSocket,batch,buffers,hostField,generation](BoostEC const& error, std::size_t){
+    // requests completed during the write report now - their buffers are no longer used
+    for(auto& item : *batch){
+      if(--item->_writes == 0 && item->_completed && item->_request){
+        report(*item);
+      }
+    }
+    handleWrite(error, generation);
+  });
+  if(_configuration._ssl){
+    ba::async_write(*sslSocket, *buffers, handler);
+  } else {
+    ba::async_write(*socket, *buffers, handler);
+  }
+  startRead();
+}
+
+bool AsioHttpConnection::closedWhileIdle(){
+  // no read is pending - a non-blocking read returns would_block on an open
+  // connection. The tls stream handles records without data (e.g. session
+  // tickets) and reports the close_notify of the server.
+  BoostEC error, ignored;
+  uint8_t byte;
+  _socket->non_blocking(true, ignored);
+  if(_configuration._ssl){
+    _sslSocket->read_some(ba::buffer(&byte, 1), error);
+  } else {
+    _socket->read_some(ba::buffer(&byte, 1), error);
+  }
+  _socket->non_blocking(false, ignored);
+  return error != ba::error::would_block;
+}
+
+void AsioHttpConnection::handleWrite(BoostEC const& error, uint64_t generation){
+  if(generation != _generation){
+    return; // the socket has been replaced
+  }
+  _writing = false;
+  if(error){
+    FUERTE_LOG_DEBUG << "http write failed -- " << error.message() << std::endl;
+    resetConnection();
+    return;
+  }
+  startWrite();
+}
+
+void AsioHttpConnection::startRead(){
+  // an idle connection is not read - run() would not return otherwise
+  if(!_connected || _reading || _inFlight.empty()){
+    return;
+  }
+  _reading = true;
+
+  // make room at the end of the receive buffer
+  if(_receiveBegin == _receiveEnd){
+    _receiveBegin = _receiveEnd = 0;
+  } else if(_receiveBegin && _receiveEnd == _receiveBuffer.size()){
+    std::memmove(_receiveBuffer.data(), _receiveBuffer.data() + _receiveBegin, _receiveEnd - _receiveBegin);
+    _receiveEnd -= _receiveBegin;
+    _receiveBegin = 0;
+  }
+  if(_receiveEnd == _receiveBuffer.size()){
+    _receiveBuffer.resize(std::max<std::size_t>(_receiveBuffer.size() * 2, 4096));
+  }
+
+  // the connection may be destroyed while it waits for data
+  std::weak_ptr<AsioHttpConnection> weak = shared_from_this();
+  auto socket = _socket;
+  auto sslSocket = _sslSocket;
+  uint64_t generation = _generation;
+  auto buffer = ba::buffer(_receiveBuffer.data() + _receiveEnd, _receiveBuffer.size() - _receiveEnd);
+  auto handler = _strand.wrap([weak,socket,sslSocket,generation](BoostEC const& error, std::size_t transferred){
+    auto self = weak.lock();
+    if(self){
+      self->handleRead(error, transferred, generation);
+    }
+  });
+  if(_configuration._ssl){
+    sslSocket->async_read_some(buffer, handler);
+  } else {
+    socket->async_read_some(buffer, handler);
+  }
+}
+
+void AsioHttpConnection::handleRead(BoostEC const& error, std::size_t transferred, uint64_t generation){
+  if(generation != _generation){
+    return;
+  }
+  _reading = false;
+  if(error){
+    if(_parseState == ParseState::UntilClose && error == ba::error::eof){
+      // the end of the connection is the end of the body - eof is only
+      // reported for a clean shutdown of a tls connection (close_notify)
+      completeResponse(); // resets the connection
+      return;
+    }
+    FUERTE_LOG_DEBUG << "http read failed -- " << error.message() << std::endl;
+    resetConnection();
+    return;
+  }
+
+  _receiveEnd += transferred;
+  try {
+    while(generation == _generation && parse()){}
+  } catch(std::exception const& e){
+    FUERTE_LOG_ERROR << "invalid http response -- " << e.what() << std::endl;
+    // the request got its response - sending it again does not help
+    if(!_inFlight.empty()){
+      ItemSP item = std::move(_inFlight.front());
+      _inFlight.pop_front();
+      fail(*item, ErrorCondition::ConnectionError);
+    }
+    resetConnection();
+    return;
+  }
+  if(generation == _generation){ // not closed after a response
+    startRead();
+  }
+}
+
+bool AsioHttpConnection::parse(){
+  char const* data = reinterpret_cast<char const*>(_receiveBuffer.data()) + _receiveBegin;
+  std::size_t available = _receiveEnd - _receiveBegin;
+
+  switch(_parseState){
+    case ParseState::Header: {
+      char const* found = std::search(data, data + available, headerEnd, headerEnd + 4);
+      if(found == data + available){
+        if(available > maxHeaderSize){
+          throw std::runtime_error("header too large");
+        }
+        return false;
+      }
+      std::size_t length = found - data + 4;
+      _receiveBegin += length;
+      parseHeader(data, length);
+      return true;
+    }
+
+    case ParseState::Body:
+    case ParseState::ChunkData: {
+      if(!available){
+        return false;
+      }
+      std::size_t length = std::min(available, _bodyLeft);
+      _body.append(reinterpret_cast<uint8_t const*>(data), length);
+      _receiveBegin += length;
+      _bodyLeft -= length;
+      if(!_bodyLeft){
+        if(_parseState == ParseState::Body){
+          completeResponse();
+        } else {
+          _parseState = ParseState::ChunkEnd;
+        }
+      }
+      return true;
+    }
+
+    case ParseState::ChunkEnd: {
+      if(available < 2){
+        return false;
+      }
+      if(data[0] != '\r' || data[1] != '\n'){
+        throw std::runtime_error("invalid chunk");
+      }
+      _receiveBegin += 2;
+      _parseState = ParseState::ChunkSize;
+      return true;
+    }
+
+    case ParseState::ChunkSize:
+    case ParseState::Trailer: {
+      char const* found = std::search(data, data + available, crlf, crlf + 2);
+      if(found == data + available){
+        if(available > maxHeaderSize){
+          throw std::runtime_error("chunk size line too large");
+        }
+        return false;
+      }
+      std::string line(data, found);
+      _receiveBegin += line.size() + 2;
+      if(_parseState == ParseState::Trailer){
+        if(line.empty()){
+          completeResponse();
+        }
+        return true;
+      }
+      // chunk extensions after the size are ignored
+      std::size_t size = std::stoul(line, nullptr, 16);
+      if(size){
+        _body.reserve(size);
+        _bodyLeft = size;
+        _parseState = ParseState::ChunkData;
+      } else {
+        _parseState = ParseState::Trailer;
+      }
+      return true;
+    }
+
+    case ParseState::UntilClose: {
+      _body.append(reinterpret_cast<uint8_t const*>(data), available);
+      _receiveBegin += available;
+      return false;
+    }
+  }
+  return false;
+}
+
+void AsioHttpConnection::parseHeader(char const* begin, std::size_t length){
+  char const* end = begin + length - 2; // keep the CRLF of the last field
+  char const* lineEnd = std::search(begin, end, crlf, crlf + 2);
+  std::string statusLine(begin, lineEnd);
+  // HTTP/1.x code reason
+  if(statusLine.size() < 12 || statusLine.compare(0, 7, "HTTP/1.") != 0){
+    throw std::runtime_error("invalid status line");
+  }
+  unsigned code = std::stoul(statusLine.substr(9, 3));
+  if(code >= 100 && code < 200){
+    return; // interim response - the final one follows
+  }
+  if(_inFlight.empty()){
+    throw std::runtime_error("response without request");
+  }
+
+  mapss fields;
+  while(lineEnd != end){
+    char const* lineBegin = lineEnd + 2;
+    lineEnd = std::search(lineBegin, end, crlf, crlf + 2);
+    char const* colon = std::find(lineBegin, lineEnd, ':');
+    if(colon == lineEnd){
+      continue;
+    }
+    char const* value = colon + 1;
+    while(value != lineEnd && (*value == ' ' || *value == '\t')){ ++value; }
+    char const* valueEnd = lineEnd;
+    while(valueEnd != value && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t')){ --valueEnd; }
+    fields[toLower(std::string(lineBegin, colon))] = std::string(value, valueEnd);
+  }
+
+  HttpRequestItem const& item = *_inFlight.front();
+  _response.reset(new Response());
+  _response->header.responseCode = code;
+  _response->messageid = item._messageId;
+  _body.clear();
+
+  auto connection = fields.find("connection");
+  bool http10 = statusLine[7] == '0';
+  if(connection != fields.end()){
+    std::string value = toLower(connection->second);
+    _closeAfterResponse = value == "close" || (http10 && value != "keep-alive");
+  } else {
+    _closeAfterResponse = http10;
+  }
+
+  auto transferEncoding = fields.find("transfer-encoding");
+  auto contentLength = fields.find("content-length");
+  bool chunked = transferEncoding != fields.end() &&
+                 toLower(transferEncoding->second).find("chunked") != std::string::npos;
+  bool hasLength = contentLength != fields.end();
+  std::string lengthValue = hasLength ? contentLength->second : std::string();
+  _response->header.meta = std::move(fields);
+
+  if(item._head || code == 204 || code == 304){
+    completeResponse();
+  } else if(chunked){
+    _parseState = ParseState::ChunkSize;
+  } else if(hasLength){
+    _bodyLeft = std::stoull(lengthValue);
+    if(_bodyLeft){
+      _body.reserve(_bodyLeft);
+      _parseState = ParseState::Body;
+    } else {
+      completeResponse();
+    }
+  } else {
+    _parseState = ParseState::UntilClose;
+    _closeAfterResponse = true;
+  }
+}
+
+void AsioHttpConnection::completeResponse(){
+  ItemSP item = std::move(_inFlight.front());
+  _inFlight.pop_front();
+  ResponseUP response = std::move(_response);
+  _parseState = ParseState::Header;
+
+  if(_body.byteSize()){
+    if(response->contentType() == ContentType::VPack){
+      // the response shares the buffer
+      auto buffer = std::make_shared<VBuffer>(std::move(_body));
+      response->addVPack(std::shared_ptr<uint8_t const>(buffer, buffer->data()), buffer->byteSize());
+    } else {
+      response->addBinarySingle(std::move(_body));
+    }
+    _body.clear();
+  }
+
+  if(finish(*item)){
+    item->_response = std::move(response);
+    if(!item->_writes){
+      report(*item);
+    }
+  }
+  if(_closeAfterResponse){
+    resetConnection();
+  }
+}
+
+// COMPLETION / TIMEOUTS //////////////////////////////////////////////////////
+
+bool AsioHttpConnection::finish(HttpRequestItem& item){
+  if(item._completed){
+    return false;
+  }
+  item._completed = true;
+  if(--_requestsLeft == 0){
+    // do not keep the connection and the io_service busy
+    _timer.cancel();
+    _timerExpiry = Clock::time_point::max();
+  }
+  return true;
+}
+
+void AsioHttpConnection::fail(HttpRequestItem& item, ErrorCondition error){
+  if(!finish(item)){
+    return;
+  }
+  item._error = error;
+  if(!item._writes){
+    report(item);
+  }
+}
+
+void AsioHttpConnection::report(HttpRequestItem& item){
+  if(item._response){
+    item._onSuccess(std::move(item._request), std::move(item._response));
+  } else {
+    FUERTE_LOG_DEBUG << "http request failed, messageid: " << item._messageId << " -- " << to_string(item._error) << std::endl;
+    item._onError(errorToInt(item._error), std::move(item._request), nullptr);
+  }
+}
+
+void AsioHttpConnection::armTimer(Clock::time_point deadline){
+  if(deadline >= _timerExpiry){
+    return;
+  }
+  _timerExpiry = deadline;
+  _timer.expires_at(deadline);
+  auto self = shared_from_this();
+  _timer.async_wait(_strand.wrap([this,self](BoostEC const& error){ handleTimer(error); }));
+}
+
+void AsioHttpConnection::handleTimer(BoostEC const& error){
+  if(error == ba::error::operation_aborted){
+    return;
+  }
+  _timerExpiry = Clock::time_point::max();
+  auto now = Clock::now();
+  auto next = Clock::time_point::max();
+
+  for(auto it = _queue.begin(); it != _queue.end();){
+    ItemSP item = *it;
+    if(item->_completed || item->_deadline <= now){
+      it = _queue.erase(it);
+      fail(*item, ErrorCondition::Timeout);
+    } else {
+      next = std::min(next, item->_deadline);
+      ++it;
+    }
+  }
+
+  bool expired = false;
+  for(auto& item : _inFlight){
+    if(item->_completed){
+      continue;
+    }
+    if(item->_deadline <= now){
+      fail(*item, ErrorCondition::Timeout);
+      expired = true;
+    } else {
+      next = std::min(next, item->_deadline);
+    }
+  }
+  if(expired){
+    // the server is stuck - the responses of all following
+    // requests would be delayed as well
+    resetConnection();
+  }
+  if(next != Clock::time_point::max()){
+    armTimer(next);
+  }
+}
+
+}}}}
@@ -0,0 +1,199 @@
+////////////////////////////////////////////////////////////////////////////////
+/// DISCLAIMER
+///
+/// Copyright 2016 ArangoDB GmbH, Cologne, Germany
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+///
+/// Copyright holder is ArangoDB GmbH, Cologne, Germany
+///
+/// @author Jan Christoph Uhde
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#ifndef ARANGO_CXX_DRIVER_ASIO_HTTP_CONNECTION_H
+#define ARANGO_CXX_DRIVER_ASIO_HTTP_CONNECTION_H 1
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <vector>
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+
+#include <fuerte/connection_interface.h>
+
+namespace arangodb { namespace fuerte { inline namespace v1 {
+
+class Loop;
+
+namespace http {
+
+// Item that represents a request of an AsioHttpConnection
+struct HttpRequestItem {
+  std::unique_ptr<Request> _request;
+  OnErrorCallback _onError;
+  OnSuccessCallback _onSuccess;
+  MessageID _messageId;
+  std::string _requestLine;   // the Host field of the connection follows
+  std::string _requestFields; // header fields and the empty line
+  bool _idempotent = false;   // may be sent again after the connection is lost
+  bool _head = false;         // the response has no body
+  bool _completed = false;    // the result is known - a late response is dropped
+  unsigned _writes = 0;       // pending writes of the buffers - the callback waits for them
+  ErrorCondition _error = ErrorCondition::NoError;
+  std::unique_ptr<Response> _response;
+  std::chrono::steady_clock::time_point _deadline;
+};
+
+// Http/1.1 connection implemented with asio instead of curl.
+//
+// The connection keeps a single socket to the server open and pipelines
+// the requests: every write sends all queued requests and the responses are
+// assigned to the written requests in order. Responses are parsed as they
+// arrive, the body is collected in a VBuffer that is handed to the Response
+// without copying.
+//
+// All state is modified in _strand, sendRequest and cancel only post to it.
+// Requests that time out or are canceled after they have been written keep
+// their place until their response arrives. When the connection is lost,
+// written idempotent requests are sent again on a new one, other written
+// requests fail with ErrorCondition::ConnectionError. Connecting follows
+// VstConnection: the failover hosts are tried in order and a round over all
+// hosts is repeated with exponential backoff before the queued requests fail
+// with ErrorCondition::CouldNotConnect.
+class AsioHttpConnection : public std::enable_shared_from_this<AsioHttpConnection>, public ConnectionInterface {
+public:
+  // number of bytes collected for a single async_write (a write always
+  // contains at least one request)
+  static constexpr std::size_t maxWriteBatchSize = 256 * 1024;
+
+  explicit AsioHttpConnection(detail::ConnectionConfiguration const&);
+  ~AsioHttpConnection();
+
+public:
+  MessageID sendRequest(std::unique_ptr<Request>
+                       ,OnErrorCallback
+                       ,OnSuccessCallback) override;
+
+  // synchronous operation for sending Requests implemented using the
+  // asynchronous operation and a condition variable - returns nullptr if
+  // the request fails without a response
+  std::unique_ptr<Response> sendRequest(std::unique_ptr<Request>) override;
+
+  std::size_t requestsLeft() override { return _requestsLeft; }
+
+  void cancel(MessageID) override;
+
+private:
+  using ItemSP = std::shared_ptr<HttpRequestItem>;
+
+  enum class ParseState {
+    Header,      // status line and header fields
+    Body,        // _bodyLeft bytes
+    ChunkSize,   // size line of the next chunk
+    ChunkData,   // _bodyLeft bytes of the current chunk
+    ChunkEnd,    // CRLF after the chunk data
+    Trailer,     // trailer fields after the last chunk
+    UntilClose   // body without length - ends with the connection
+  };
+
+  // creates request line and header fields (without Host)
+  void buildHeader(Request const&, HttpRequestItem&) const;
+
+  // CONNECTING ////////////////////////////////////////////////////////////
+  // starts a round over all hosts
+  void startConnect();
+  // resolves the current host and connects to it - retries or fails the
+  // queued requests when no host is left
+  void startResolve();
+  void handleConnect(boost::system::error_code const&, uint64_t generation);
+  // gives up on the current host
+  void nextHost();
+  void finishConnect();
+  void closeSocket();
+  // closes the socket - written requests are sent again or fail, queued
+  // requests are sent on a new connection
+  void resetConnection();
+  // fails every request that has not been written
+  void failQueued(ErrorCondition);
+
+  // WRITING / READING /////////////////////////////////////////////////////
+  void startWrite();
+  void handleWrite(boost::system::error_code const&, uint64_t generation);
+  // an idle connection is not read - returns true if the server closed it
+  // (or sent data nobody asked for) meanwhile
+  bool closedWhileIdle();
+  void startRead();
+  void handleRead(boost::system::error_code const&, std::size_t transferred, uint64_t generation);
+  // consumes received data - returns false if more data is needed
+  bool parse();
+  void parseHeader(char const* begin, std::size_t length);
+  // hands the parsed response to the first written request
+  void completeResponse();
+
+  // COMPLETION / TIMEOUTS /////////////////////////////////////////////////
+  // marks the item as completed - returns false if it has been before
+  bool finish(HttpRequestItem&);
+  void fail(HttpRequestItem&, ErrorCondition);
+  // calls the callback of a completed item
+  void report(HttpRequestItem&);
+  void armTimer(std::chrono::steady_clock::time_point);
+  void handleTimer(boost::system::error_code const&);
+
+private:
+  std::shared_ptr<Loop> _asioLoop;
+  detail::ConnectionConfiguration _configuration;
+  ::std::atomic_uint_least64_t _messageId;
+  ::std::atomic_size_t _requestsLeft; // callbacks that have not been called
+  ::boost::asio::io_service* _ioService;
+  ::boost::asio::io_service::strand _strand;
+  // socket
+  ::boost::asio::ip::tcp::resolver _resolver;
+  ::boost::asio::ssl::context _context;
+  ::std::shared_ptr<::boost::asio::ip::tcp::socket> _socket;
+  ::std::shared_ptr<::boost::asio::ssl::stream<::boost::asio::ip::tcp::socket&>> _sslSocket;
+  ::boost::asio::steady_timer _connectTimer; // connect timeout and reconnect delay
+  ::std::vector<::std::pair<::std::string,::std::string>> _hosts; // host, port
+  ::std::size_t _hostIndex;
+  unsigned _reconnectAttempt;
+  // Host field of the current host - shared with the writes in progress
+  ::std::shared_ptr<::std::string> _hostField;
+  uint64_t _generation; // incremented for every socket - handlers of old ones are ignored
+  bool _connecting;
+  bool _connected;
+  bool _writing;
+  bool _reading;
+  // requests that have not been written
+  ::std::deque<ItemSP> _queue;
+  // written requests in the order of their responses
+  ::std::deque<ItemSP> _inFlight;
+  // receiving - data between _receiveBegin and _receiveEnd is not parsed
+  ::std::vector<uint8_t> _receiveBuffer;
+  ::std::size_t _receiveBegin;
+  ::std::size_t _receiveEnd;
+  ParseState _parseState;
+  ::std::unique_ptr<Response> _response; // being parsed
+  VBuffer _body;
+  ::std::size_t _bodyLeft;
+  bool _closeAfterResponse; // the server closes the connection
+  // timeouts of queued and written requests
+  ::boost::asio::steady_timer _timer;
+  ::std::chrono::steady_clock::time_point _timerExpiry; // max() if not armed
+};
+
+}}}}
+#endif
@@ -0,0 +1,114 @@
+////////////////////////////////////////////////////////////////////////////////
+/// DISCLAIMER
+///
+/// Copyright 2016 ArangoDB GmbH, Cologne, Germany
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+///
+/// Copyright holder is ArangoDB GmbH, Cologne, Germany
+///
+/// @author Jan Christoph Uhde
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#ifndef ARANGO_CXX_DRIVER_CONCURRENCY_LIMITER_H
+#define ARANGO_CXX_DRIVER_CONCURRENCY_LIMITER_H 1
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+
+namespace arangodb { namespace fuerte { inline namespace v1 {
+
+// Adaptive limit for the number of requests in flight (AIMD).
+//
+// Every successful request raises the limit by 1/limit(), so it grows by one
+// per round of limit() requests while the latency stays close to the
+// lowest latency seen (the baseline). When the smoothed latency exceeds the
+// baseline by the given factor or a request fails because of a timeout or a
+// connection problem, the limit is multiplied by the backoff factor. After a
+// decrease the requests of the next round are not used for another one - they
+// have been sent with the old limit. The baseline slowly follows the latency
+// upwards, so a permanent change of the server's response time is accepted.
+// The limiter is not synchronized.
+class ConcurrencyLimiter {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  ConcurrencyLimiter(std::size_t maxLimit
+                    ,std::size_t initialLimit = 8
+                    ,double backoff = 0.5
+                    ,double tolerance = 2.0)
+    : _maxLimit(std::max<std::size_t>(maxLimit, 1))
+    , _limit(static_cast<double>(std::min(std::max<std::size_t>(initialLimit, 1), _maxLimit)))
+    , _backoff(backoff)
+    , _tolerance(tolerance)
+    , _baseline(0)
+    , _average(0)
+    , _holdOff(0)
+    {}
+
+  // limiter for the configured maximum of requests in flight (0 if there is
+  // none). A configured maximum is the initial limit as well, so a caller that
+  // waits for room is not held at the default start.
+  static ConcurrencyLimiter forMaxInFlight(std::size_t maxInFlight){
+    return maxInFlight ? ConcurrencyLimiter(maxInFlight, maxInFlight) : ConcurrencyLimiter(1024);
+  }
+
+  std::size_t limit() const { return static_cast<std::size_t>(_limit); }
+
+  void onSuccess(Clock::duration latency){
+    double sample = std::chrono::duration<double, std::micro>(latency).count();
+    if(_baseline == 0 || sample < _baseline){
+      _baseline = sample;
+    } else {
+      _baseline += (sample - _baseline) / 1024;
+    }
+    _average = _average == 0 ? sample : _average + (sample - _average) / 8;
+
+    if(_average > _baseline * _tolerance){
+      decrease();
+    } else {
+      // one per round of limit() requests
+      _limit = std::min(_limit + 1.0 / limit(), static_cast<double>(_maxLimit));
+      if(_holdOff){ --_holdOff; }
+    }
+  }
+
+  // the request failed because the server is overloaded or unreachable
+  void onError(){
+    decrease();
+  }
+
+private:
+  void decrease(){
+    if(_holdOff){
+      --_holdOff;
+      return;
+    }
+    _holdOff = limit(); // requests sent with the old limit
+    _limit = std::max(_limit * _backoff, 1.0);
+    _average = _baseline; // judge the new limit by its own samples
+  }
+
+  std::size_t _maxLimit;
+  double _limit;
+  double _backoff;   // factor applied on congestion
+  double _tolerance; // accepted ratio of the latency to the baseline
+  double _baseline;  // in microseconds
+  double _average;   // in microseconds
+  std::size_t _holdOff; // samples to ignore for decreases
+};
+
+}}}
+#endif
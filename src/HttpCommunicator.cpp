@@ -23,14 +23,15 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 #include "HttpCommunicator.h"
-#include <fcntl.h>
 #include <velocypack/Parser.h>
 #include <cassert>
+#include <iterator>
 #include <sstream>
 #include <atomic>
 #include <cassert>
 
 #include <fuerte/helper.h>
+#include <fuerte/loop.h>
 
 namespace arangodb {
 namespace fuerte {
@@ -40,46 +41,24 @@ namespace http {
 // --SECTION--                                      constructors and destructors
 // -----------------------------------------------------------------------------
 
-std::mutex HttpCommunicator::_curlLock;
+constexpr std::size_t HttpCommunicator::maxIdleHandles;
 
-HttpCommunicator::HttpCommunicator() : _curl(nullptr), _useCount(0) {
+HttpCommunicator::HttpCommunicator(std::shared_ptr<Loop> loop)
+    : _limitConcurrency(false), _maxConcurrency(0),
+      _curl(nullptr), _share(nullptr), _processScheduled(false), _useCount(0), _requestsLeft(0), _loop(std::move(loop)),
+      _ioService(nullptr) {
   curl_global_init(CURL_GLOBAL_ALL);
   _curl = curl_multi_init();
 
-#ifdef _WIN32
-  int err = dumb_socketpair(_socks, 0);
-  if (err != 0) {
-    throw std::runtime_error("Couldn't setup sockets. Error was: " +
-                             std::to_string(err));
-  }
-  _wakeup.fd = _socks[0];
-#else
-  int result = pipe(_fds);
-  if (result != 0) {
-    throw std::runtime_error("Couldn't setup pipe. Return code was: " +
-                             std::to_string(result));
-  }
-
-  long flags = fcntl(_fds[0], F_GETFL, 0);
-
-  if (flags < 0) {
-    throw std::runtime_error(
-        "Couldn't set pipe to non-blocking. Return code was: " +
-        std::to_string(flags));
-  }
-
-  flags = fcntl(_fds[0], F_SETFL, flags | O_NONBLOCK);
+  curl_multi_setopt(_curl, CURLMOPT_SOCKETFUNCTION, HttpCommunicator::socketCallback);
+  curl_multi_setopt(_curl, CURLMOPT_SOCKETDATA, this);
+  curl_multi_setopt(_curl, CURLMOPT_TIMERFUNCTION, HttpCommunicator::timerCallback);
+  curl_multi_setopt(_curl, CURLMOPT_TIMERDATA, this);
 
-  if (flags < 0) {
-    throw std::runtime_error(
-        "Couldn't set pipe to non-blocking. Return code was: " +
-        std::to_string(flags));
-  }
-
-  _wakeup.fd = _fds[0];
-#endif
-
-  _wakeup.events = CURL_WAIT_POLLIN | CURL_WAIT_POLLPRI;
+  // the handles are only used in the strand - no lock functions needed
+  _share = curl_share_init();
+  curl_share_setopt(_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
 }
 
 HttpCommunicator::~HttpCommunicator() {
@@ -90,7 +69,24 @@ HttpCommunicator::~HttpCommunicator() {
                          << " outstanding requests!"
                          << std::endl;
   }
+  for (auto& handle : _handlesInProgress) {
+    curl_multi_remove_handle(_curl, handle.second->_handle);
+  }
+  _handlesInProgress.clear();
+  for (auto handle : _idleHandles) {
+    curl_easy_cleanup(handle);
+  }
+  _idleHandles.clear();
+
+  // the sockets belong to curl
+  for (auto& socket : _sockets) {
+    boost::system::error_code ec;
+    socket.second->_descriptor.cancel(ec);
+    socket.second->_descriptor.release();
+  }
+  _sockets.clear();
   ::curl_multi_cleanup(_curl);
+  ::curl_share_cleanup(_share);
   ::curl_global_cleanup();
 }
 
@@ -103,50 +99,218 @@ uint64_t HttpCommunicator::queueRequest(Destination destination,
                                     Callbacks callbacks) {
   FUERTE_LOG_HTTPTRACE << "queueRequest - start - at address: " << request.get() << std::endl;
   static std::atomic<uint64_t> ticketId(0);
-      //std::chrono::duration_cast<std::chrono::microseconds>(
-      //    std::chrono::steady_clock::now().time_since_epoch())
-      //    .count();
+  initialize();
   NewRequest newRequest;
   newRequest._destination = destination;
   newRequest._fuRequest = std::move(request);
-  newRequest._callbacks = callbacks;
-
+  // the request is left until one of its callbacks is called
+  newRequest._callbacks = Callbacks(
+      [this, callbacks](std::unique_ptr<Request> fuRequest,
+                        std::unique_ptr<Response> fuResponse) {
+        --_requestsLeft;
+        callbacks._onSuccess(std::move(fuRequest), std::move(fuResponse));
+      },
+      [this, callbacks](Error error, std::unique_ptr<Request> fuRequest,
+                        std::unique_ptr<Response> fuResponse) {
+        --_requestsLeft;
+        callbacks._onError(error, std::move(fuRequest), std::move(fuResponse));
+      });
+  newRequest._options.requestTimeout = newRequest._fuRequest->timeout().count() / 1000.0;
+
+  uint64_t thisId;
   {
     std::lock_guard<std::mutex> guard(_newRequestsLock);
-    uint64_t thisId = ++ticketId;
+    thisId = ++ticketId;
     newRequest._fuRequest->messageid = thisId;
+    ++_requestsLeft;
     _newRequests.emplace_back(std::move(newRequest));
-    FUERTE_LOG_HTTPTRACE << "queueRequest - end" << std::endl;
-    return thisId;
   }
+  scheduleProcessQueues();
+  FUERTE_LOG_HTTPTRACE << "queueRequest - end" << std::endl;
+  return thisId;
+}
+
+void HttpCommunicator::cancelRequest(uint64_t ticketId) {
+  initialize();
+  {
+    std::lock_guard<std::mutex> guard(_newRequestsLock);
+    _cancelRequests.push_back(ticketId);
+  }
+  scheduleProcessQueues();
+}
+
+void HttpCommunicator::limitConcurrency(std::size_t maxRequests) {
+  initialize();
+  // requests of the connection are queued later, so the limiter
+  // exists before they are processed
+  _strand->post([this, maxRequests]() {
+    if (!_limitConcurrency) {
+      _limitConcurrency = true;
+      _maxConcurrency = maxRequests;
+    }
+  });
+}
+
+void HttpCommunicator::limitConnections(std::size_t perHost, std::size_t total) {
+  initialize();
+  _strand->post([this, perHost, total]() {
+    curl_multi_setopt(_curl, CURLMOPT_MAX_HOST_CONNECTIONS, static_cast<long>(perHost));
+    curl_multi_setopt(_curl, CURLMOPT_MAX_TOTAL_CONNECTIONS, static_cast<long>(total));
+  });
+}
+
+void HttpCommunicator::initialize() {
+  std::call_once(_initialized, [this]() {
+    _ioService = _loop->getIoService();
+    _strand.reset(new boost::asio::io_service::strand(*_ioService));
+    _timer.reset(new boost::asio::steady_timer(*_ioService));
+  });
 }
 
-int HttpCommunicator::workOnce() {
-  std::lock_guard<std::mutex> guard(_curlLock);
+void HttpCommunicator::scheduleProcessQueues() {
+  // a burst of requests is handed to curl by a single handler
+  if (!_processScheduled.exchange(true)) {
+    _strand->post([this]() { processQueues(); });
+  }
+}
 
-  FUERTE_LOG_DEBUG << "fuerte - HttpCommunicator: work once" << std::endl;
+void HttpCommunicator::processQueues() {
+  FUERTE_LOG_DEBUG << "fuerte - HttpCommunicator: process queues" << std::endl;
+  // requests queued from now on need another run
+  _processScheduled = false;
+  // requests that have been held back are first in line
   std::vector<NewRequest> newRequests;
+  newRequests.swap(_waitingRequests);
 
   {
     std::lock_guard<std::mutex> guard(_newRequestsLock);
-    newRequests.swap(_newRequests);
+    std::move(_newRequests.begin(), _newRequests.end(), std::back_inserter(newRequests));
+    _newRequests.clear();
   }
 
-  for (auto&& newRequest : newRequests) {
-    createRequestInProgress(std::move(newRequest));
+  cancelRequests(newRequests);
 
-    FUERTE_LOG_HTTPTRACE << "CREATE REQUEST\n";
+  // added handles are started by curl's timer callback
+  _waitingRequests = std::move(newRequests);
+  startWaitingRequests();
+}
+
+// -----------------------------------------------------------------------------
+// --SECTION--                                                    event handling
+// -----------------------------------------------------------------------------
+
+// called by curl from within curl_multi_socket_action - always in the strand
+int HttpCommunicator::socketCallback(CURL*, curl_socket_t fd, int what,
+                                     void* userp, void* socketp) {
+  auto self = static_cast<HttpCommunicator*>(userp);
+  auto known = static_cast<Socket*>(socketp);
+
+  if (what == CURL_POLL_REMOVE) {
+    if (known) {
+      // curl closes the socket itself
+      boost::system::error_code ec;
+      known->_removed = true;
+      known->_descriptor.cancel(ec);
+      known->_descriptor.release();
+      self->_sockets.erase(fd);
+    }
+    return 0;
+  }
+
+  std::shared_ptr<Socket> socket;
+  if (known) {
+    socket = known->shared_from_this();
+  } else {
+    socket = std::make_shared<Socket>(*self->_ioService, fd);
+    self->_sockets[fd] = socket;
+    curl_multi_assign(self->_curl, fd, socket.get());
+  }
+  socket->_what = what;
+  self->watchSocket(socket);
+  return 0;
+}
+
+// called by curl when the timeout for curl_multi_socket_action changes
+int HttpCommunicator::timerCallback(CURLM*, long timeoutMs, void* userp) {
+  auto self = static_cast<HttpCommunicator*>(userp);
+  if (!self->_timer) {
+    return 0;  // no request has been queued
+  }
+  self->_timer->cancel();
+  if (timeoutMs >= 0) {
+    // curl must not be called from within its callback - even when it
+    // asks for an immediate call
+    self->_timer->expires_from_now(std::chrono::milliseconds(timeoutMs));
+    self->_timer->async_wait(self->_strand->wrap(
+        [self](boost::system::error_code const& ec) { self->handleTimeout(ec); }));
+  }
+  return 0;
+}
+
+void HttpCommunicator::watchSocket(std::shared_ptr<Socket> const& socket) {
+  using Descriptor = boost::asio::posix::stream_descriptor;
+  if ((socket->_what & CURL_POLL_IN) && !socket->_reading) {
+    socket->_reading = true;
+    socket->_descriptor.async_wait(Descriptor::wait_read, _strand->wrap(
+        [this, socket](boost::system::error_code const& ec) {
+          handleSocketEvent(socket, CURL_CSELECT_IN, ec);
+        }));
+  }
+  if ((socket->_what & CURL_POLL_OUT) && !socket->_writing) {
+    socket->_writing = true;
+    socket->_descriptor.async_wait(Descriptor::wait_write, _strand->wrap(
+        [this, socket](boost::system::error_code const& ec) {
+          handleSocketEvent(socket, CURL_CSELECT_OUT, ec);
+        }));
   }
+}
 
-  _mc = curl_multi_perform(_curl, &_stillRunning);
+void HttpCommunicator::handleSocketEvent(std::shared_ptr<Socket> const& socket,
+                                         int event,
+                                         boost::system::error_code const& ec) {
+  if (event == CURL_CSELECT_IN) {
+    socket->_reading = false;
+  } else {
+    socket->_writing = false;
+  }
+  if (socket->_removed || ec == boost::asio::error::operation_aborted) {
+    return;
+  }
+  if (!(socket->_what & (event == CURL_CSELECT_IN ? CURL_POLL_IN : CURL_POLL_OUT))) {
+    return;  // curl lost interest in the meantime
+  }
 
-  if (_mc != CURLM_OK) {
+  int running = 0;
+  CURLMcode mc = curl_multi_socket_action(
+      _curl, socket->_fd, ec ? CURL_CSELECT_ERR : event, &running);
+  if (mc != CURLM_OK) {
     throw std::runtime_error(
         "Invalid curl multi result while performing! Result was " +
-        std::to_string(_mc));
+        std::to_string(mc));
   }
+  checkMultiInfo();
 
-  // handle all messages received
+  // the socket callback may have removed the socket or changed its events
+  if (!socket->_removed) {
+    watchSocket(socket);
+  }
+}
+
+void HttpCommunicator::handleTimeout(boost::system::error_code const& ec) {
+  if (ec == boost::asio::error::operation_aborted) {
+    return;
+  }
+  int running = 0;
+  CURLMcode mc = curl_multi_socket_action(_curl, CURL_SOCKET_TIMEOUT, 0, &running);
+  if (mc != CURLM_OK) {
+    throw std::runtime_error(
+        "Invalid curl multi result while performing! Result was " +
+        std::to_string(mc));
+  }
+  checkMultiInfo();
+}
+
+void HttpCommunicator::checkMultiInfo() {
   CURLMsg* msg = nullptr;
   int msgsLeft = 0;
 
@@ -158,20 +322,8 @@ int HttpCommunicator::workOnce() {
     }
   }
 
-  return _stillRunning;
-}
-
-void HttpCommunicator::wait() {
-  static int const MAX_WAIT_MSECS = 1000;  // wait max. 1 seconds
-
-  int numFds;  // not used here
-  int res = curl_multi_wait(_curl, &_wakeup, 1, MAX_WAIT_MSECS, &numFds);
-
-  if (res != CURLM_OK) {
-    throw std::runtime_error(
-        "Invalid curl multi result while waiting! Result was " +
-        std::to_string(res));
-  }
+  // completed requests make room for waiting ones
+  startWaitingRequests();
 }
 
 // -----------------------------------------------------------------------------
@@ -343,11 +495,126 @@ std::string HttpCommunicator::createSafeDottedCurlUrl(
   return url;
 }
 
+// removes canceled requests from the new requests or from the requests in
+// progress and calls their error callbacks
+void HttpCommunicator::cancelRequests(std::vector<NewRequest>& newRequests) {
+  std::vector<uint64_t> cancel;
+  {
+    std::lock_guard<std::mutex> guard(_newRequestsLock);
+    cancel.swap(_cancelRequests);
+  }
+
+  for (auto ticketId : cancel) {
+    auto newRequest = std::find_if(newRequests.begin(), newRequests.end(),
+        [ticketId](NewRequest const& r){ return r._fuRequest->messageid == ticketId; });
+    if (newRequest != newRequests.end()) {
+      NewRequest canceled = std::move(*newRequest);
+      newRequests.erase(newRequest);
+      canceled._callbacks._onError(errorToInt(ErrorCondition::Canceled),
+                                   std::move(canceled._fuRequest), {nullptr});
+      continue;
+    }
+
+    auto inProgress = _handlesInProgress.find(ticketId);
+    if (inProgress != _handlesInProgress.end()) {
+      std::unique_ptr<CurlHandle> handle = std::move(inProgress->second);
+      _handlesInProgress.erase(inProgress);
+      curl_multi_remove_handle(_curl, handle->_handle);
+      auto& request = handle->_rip->_request;
+      request._callbacks._onError(errorToInt(ErrorCondition::Canceled),
+                                  std::move(request._fuRequest), {nullptr});
+      releaseHandle(std::move(handle));
+    }
+  }
+}
+
+std::size_t HttpCommunicator::startWaitingRequests() {
+  std::size_t started = 0;
+  std::vector<NewRequest> waiting;
+  for (auto& request : _waitingRequests) {
+    // a busy server does not hold back the requests of others
+    EndpointLimit* limit = endpointLimit(request._destination);
+    if (limit && limit->_inProgress >= limit->_limiter.limit()) {
+      waiting.push_back(std::move(request));
+      continue;
+    }
+    if (limit) {
+      ++limit->_inProgress;
+      request._limited = true;
+    }
+    createRequestInProgress(std::move(request));
+    ++started;
+
+    FUERTE_LOG_HTTPTRACE << "CREATE REQUEST\n";
+  }
+  _waitingRequests = std::move(waiting);
+  return started;
+}
+
+std::string HttpCommunicator::endpointOf(Destination const& destination) {
+  // up to the first '/' after "://"
+  std::size_t start = destination.find("://");
+  start = start == std::string::npos ? 0 : start + 3;
+  return destination.substr(0, destination.find('/', start));
+}
+
+HttpCommunicator::EndpointLimit* HttpCommunicator::endpointLimit(Destination const& destination) {
+  if (!_limitConcurrency) {
+    return nullptr;
+  }
+  std::string endpoint = endpointOf(destination);
+  auto found = _endpointLimits.find(endpoint);
+  if (found == _endpointLimits.end()) {
+    found = _endpointLimits.emplace(std::move(endpoint),
+                                    EndpointLimit(ConcurrencyLimiter::forMaxInFlight(_maxConcurrency))).first;
+  }
+  return &found->second;
+}
+
+CURL* HttpCommunicator::acquireHandle() {
+  if (!_idleHandles.empty()) {
+    CURL* handle = _idleHandles.back();
+    _idleHandles.pop_back();
+    return handle;
+  }
+
+  CURL* handle = curl_easy_init();
+  if (handle == nullptr) {
+    throw std::bad_alloc();
+  }
+  // kept by curl_easy_reset
+  curl_easy_setopt(handle, CURLOPT_SHARE, _share);
+  return handle;
+}
+
+void HttpCommunicator::releaseHandle(std::unique_ptr<CurlHandle> handle) {
+  if (handle->_rip->_request._limited) {
+    --endpointLimit(handle->_rip->_request._destination)->_inProgress;
+  }
+  if (_idleHandles.size() >= maxIdleHandles) {
+    return;  // cleaned up by the CurlHandle
+  }
+  // the reset keeps the share and the connections of the handle
+  curl_easy_reset(handle->_handle);
+  _idleHandles.push_back(handle->_handle);
+  handle->_handle = nullptr;
+}
+
+void HttpCommunicator::releaseHandle(uint64_t ticketId) {
+  auto found = _handlesInProgress.find(ticketId);
+  if (found != _handlesInProgress.end()) {
+    std::unique_ptr<CurlHandle> handle = std::move(found->second);
+    _handlesInProgress.erase(found);
+    releaseHandle(std::move(handle));
+  }
+}
+
 void HttpCommunicator::createRequestInProgress(NewRequest newRequest) {
   // mop: the curl handle will be managed safely via unique_ptr and hold
   // ownership for rip
+  CURL* curlHandle = acquireHandle();
   auto rip = new RequestInProgress(std::move(newRequest));
-  std::unique_ptr<CurlHandle> handleInProgress(new CurlHandle(rip));
+  std::unique_ptr<CurlHandle> handleInProgress(new CurlHandle(curlHandle, rip));
   fuerte::Request* fuRequest = rip->_request._fuRequest.get();
 
   CURL* handle = handleInProgress->_handle;
@@ -437,16 +704,15 @@ void HttpCommunicator::createRequestInProgress(NewRequest newRequest) {
       break;
   }
 
-  std::string empty("");
-  std::string& body = empty;
-
   auto pay = fuRequest->payload();
 
   if (pay.second > 0) {
-    // https://curl.haxx.se/libcurl/c/CURLOPT_COPYPOSTFIELDS.html
-    // DO NOT CHANGE BODY SIZE LATER!!
-    curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE, pay.second);
-    curl_easy_setopt(handle, CURLOPT_COPYPOSTFIELDS, pay.first);
+    // curl reads the body from the payload of the request - the request is
+    // owned by rip and only handed to a callback after the handle has been
+    // removed from the multi handle
+    curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE_LARGE,
+                     static_cast<curl_off_t>(pay.second));
+    curl_easy_setopt(handle, CURLOPT_POSTFIELDS, pay.first);
   }
 
   handleInProgress->_rip->_startTime = std::chrono::steady_clock::now();
@@ -486,6 +752,9 @@ void HttpCommunicator::handleResult(CURL* handle, CURLcode rc) {
       case CURLE_OK: {
         long httpStatusCode = 200;
         curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &httpStatusCode);
+        if (EndpointLimit* limit = endpointLimit(rip->_request._destination)) {
+          limit->_limiter.onSuccess(std::chrono::steady_clock::now() - rip->_startTime);
+        }
 
         std::unique_ptr<Response> fuResponse(new Response());
         fuResponse->header.responseCode = static_cast<unsigned>(httpStatusCode);
@@ -518,6 +787,9 @@ void HttpCommunicator::handleResult(CURL* handle, CURLcode rc) {
       case CURLE_COULDNT_RESOLVE_HOST:
       case CURLE_URL_MALFORMAT:
       case CURLE_SEND_ERROR:
+        if (EndpointLimit* limit = endpointLimit(rip->_request._destination)) {
+          limit->_limiter.onError();
+        }
         rip->_request._callbacks._onError(
             static_cast<Error>(ErrorCondition::CouldNotConnect),
             std::move(rip->_request._fuRequest), {nullptr});
@@ -526,6 +798,9 @@ void HttpCommunicator::handleResult(CURL* handle, CURLcode rc) {
       case CURLE_OPERATION_TIMEDOUT:
       case CURLE_RECV_ERROR:
       case CURLE_GOT_NOTHING:
+        if (EndpointLimit* limit = endpointLimit(rip->_request._destination)) {
+          limit->_limiter.onError();
+        }
         rip->_request._callbacks._onError(
             static_cast<Error>(ErrorCondition::Timeout),
             std::move(rip->_request._fuRequest), {nullptr});
@@ -539,14 +814,14 @@ void HttpCommunicator::handleResult(CURL* handle, CURLcode rc) {
         break;
     }
   } catch (std::exception const& e) {
-    _handlesInProgress.erase(request_id);
+    releaseHandle(request_id);
     throw e;
   }  catch (...) {
-    _handlesInProgress.erase(request_id);
+    releaseHandle(request_id);
     throw;
   }
 
-  _handlesInProgress.erase(request_id);
+  releaseHandle(request_id);
 }
 }
 }
@@ -28,15 +28,24 @@
 #include <fuerte/types.h>
 #include <fuerte/FuerteLogger.h>
 
+#include "ConcurrencyLimiter.h"
+
 #include <curl/curl.h>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
 #include <chrono>
 #include <mutex>
+#include <unordered_map>
 
 #include <atomic>
 
 namespace arangodb {
 namespace fuerte {
 inline namespace v1 {
+class Loop;
+
 namespace http {
 typedef std::string Destination;
 // -----------------------------------------------------------------------------
@@ -70,19 +79,58 @@ class Options {
 // --SECTION--                                            class HttpCommunicator
 // -----------------------------------------------------------------------------
 
+// Runs the http requests of all http connections with a curl multi handle
+// that is driven by the asio loop of the LoopProvider.
+//
+// curl tells the communicator which sockets to watch (socketCallback) and
+// when to call it again (timerCallback). The sockets are watched with
+// stream_descriptors that do not own the socket, the timeout with a timer.
+// Every call into curl happens in _strand, so requests complete on the same
+// threads that run the vst connections and no thread polls curl.
+//
+// Easy handles are reset and kept for the next request instead of being
+// destroyed. All handles use a share object for the dns cache and the tls
+// sessions - the connection cache is shared by the multi handle.
 class HttpCommunicator {
  public:
-  HttpCommunicator();
+  // idle easy handles that are kept for reuse
+  static constexpr std::size_t maxIdleHandles = 128;
+
+  explicit HttpCommunicator(std::shared_ptr<Loop>);
   ~HttpCommunicator();
 
  public:
   uint64_t queueRequest(Destination, std::unique_ptr<Request>, Callbacks);
-  int workOnce();
-  void wait();
+  // the request is removed on the strand - its error callback is called with
+  // ErrorCondition::Canceled unless it has been completed before
+  void cancelRequest(uint64_t);
   bool used(){ return _useCount; }
   uint64_t addUser(){ return ++_useCount; }
   uint64_t delUser(){ return --_useCount; }
-  int requestsLeft(){ return _stillRunning; }
+  std::size_t requestsLeft(){ return _requestsLeft; }
+  // adapts the number of requests in progress of every server to its
+  // latency - requests above the limit wait in the communicator. The
+  // limit starts at maxRequests (0 for no upper bound).
+  void limitConcurrency(std::size_t maxRequests);
+  // connections curl opens to a single host and in total - 0 means no
+  // limit, requests above it wait in curl for a free connection
+  void limitConnections(std::size_t perHost, std::size_t total);
+
+ private:
+  // a socket curl asked us to watch - curl keeps a pointer to it
+  // (curl_multi_assign) and passes it to the socket callback
+  struct Socket : std::enable_shared_from_this<Socket> {
+    Socket(boost::asio::io_service& service, curl_socket_t fd)
+        : _descriptor(service, fd), _fd(fd), _what(CURL_POLL_NONE),
+          _reading(false), _writing(false), _removed(false) {}
+
+    boost::asio::posix::stream_descriptor _descriptor;
+    curl_socket_t _fd;
+    int _what;  // CURL_POLL_IN / CURL_POLL_OUT / CURL_POLL_INOUT
+    bool _reading;
+    bool _writing;
+    bool _removed;
+  };
 
  private:
   struct NewRequest {
@@ -90,6 +138,7 @@ class HttpCommunicator {
     std::unique_ptr<Request> _fuRequest;
     Callbacks _callbacks;
     Options _options;
+    bool _limited = false;  // counts against the limit of its server
   };
 
   class RequestInProgress {
@@ -112,7 +161,6 @@ class HttpCommunicator {
 
    public:
     NewRequest _request;
-    std::string _requestBody;
     struct curl_slist* _requestHeaders;
 
     mapss _responseHeaders;
@@ -122,14 +170,17 @@ class HttpCommunicator {
     char _errorBuffer[CURL_ERROR_SIZE];
   };
 
-  struct CurlHandle {
-    explicit CurlHandle(RequestInProgress* rip) : _handle(nullptr), _rip(rip) {
-      _handle = curl_easy_init();
-
-      if (_handle == nullptr) {
-        throw std::bad_alloc();
-      }
+  // adaptive limit of a server and its requests in progress
+  struct EndpointLimit {
+    explicit EndpointLimit(ConcurrencyLimiter limiter)
+        : _limiter(std::move(limiter)), _inProgress(0) {}
+    ConcurrencyLimiter _limiter;
+    std::size_t _inProgress;
+  };
 
+  struct CurlHandle {
+    // takes ownership of the (reset) handle
+    CurlHandle(CURL* handle, RequestInProgress* rip) : _handle(handle), _rip(rip) {
       curl_easy_setopt(_handle, CURLOPT_PRIVATE, _rip.get());
 #ifdef CURLOPT_PATH_AS_IS
       curl_easy_setopt(_handle, CURLOPT_PATH_AS_IS, 1L);
@@ -156,9 +207,38 @@ class HttpCommunicator {
   static int curlDebug(CURL*, curl_infotype, char*, size_t, void*);
   static void logHttpHeaders(std::string const&, std::string const&);
   static void logHttpBody(std::string const&, std::string const&);
+  static int socketCallback(CURL*, curl_socket_t, int, void*, void*);
+  static int timerCallback(CURLM*, long, void*);
+  // scheme, host and port of a destination
+  static std::string endpointOf(Destination const&);
 
  private:
+  // creates the strand and the timer on first use - the io_service of the
+  // loop may be replaced until then
+  void initialize();
+  // posts processQueues unless it is pending already
+  void scheduleProcessQueues();
+  // starts queued requests and removes canceled ones - runs in the strand
+  void processQueues();
+  void watchSocket(std::shared_ptr<Socket> const&);
+  void handleSocketEvent(std::shared_ptr<Socket> const&, int event,
+                         boost::system::error_code const&);
+  void handleTimeout(boost::system::error_code const&);
+  // hands completed transfers to handleResult
+  void checkMultiInfo();
   void createRequestInProgress(NewRequest);
+  // takes an idle easy handle or creates one
+  CURL* acquireHandle();
+  // limit of the destination's server - nullptr if concurrency is not limited
+  EndpointLimit* endpointLimit(Destination const&);
+  // resets the easy handle and keeps it for the next request - its request
+  // no longer counts against the limit of its server
+  void releaseHandle(std::unique_ptr<CurlHandle>);
+  void releaseHandle(uint64_t ticketId);
+  // starts waiting requests as far as the limiter allows - returns
+  // the number of started requests
+  std::size_t startWaitingRequests();
+  void cancelRequests(std::vector<NewRequest>&);
   void handleResult(CURL*, CURLcode);
   void transformResult(CURL*, mapss&&, std::string const&, Response*);
 
@@ -168,21 +248,28 @@ class HttpCommunicator {
 
  private:
   std::mutex _newRequestsLock;
-  static std::mutex _curlLock;
   std::vector<NewRequest> _newRequests;
+  std::vector<uint64_t> _cancelRequests;
+  // requests held back by the limits of their servers
+  std::vector<NewRequest> _waitingRequests;
+  bool _limitConcurrency;
+  std::size_t _maxConcurrency;  // 0 for no upper bound
+  std::unordered_map<std::string, EndpointLimit> _endpointLimits;
 
   std::unordered_map<uint64_t, std::unique_ptr<CurlHandle>> _handlesInProgress;
   CURLM* _curl;
-  CURLMcode _mc;
-  curl_waitfd _wakeup;
+  CURLSH* _share;
+  std::vector<CURL*> _idleHandles;
+  std::atomic<bool> _processScheduled;  // processQueues has been posted
   std::atomic<uint64_t> _useCount;
-  int _stillRunning;
-
-#ifdef _WIN32
-  SOCKET _socks[2];
-#else
-  int _fds[2];
-#endif
+  std::atomic<std::size_t> _requestsLeft;  // callbacks that have not been called
+
+  std::shared_ptr<Loop> _loop;
+  std::once_flag _initialized;
+  boost::asio::io_service* _ioService;
+  std::unique_ptr<boost::asio::io_service::strand> _strand;
+  std::unique_ptr<boost::asio::steady_timer> _timer;  // curl's timeout
+  std::unordered_map<curl_socket_t, std::shared_ptr<Socket>> _sockets;
 };
 }
 }
@@ -38,6 +38,12 @@ HttpConnection::HttpConnection(ConnectionConfiguration const& configuration)
     , _configuration(configuration)
     {
       _communicator->addUser();
+      if (_configuration._adaptiveInFlight) {
+        _communicator->limitConcurrency(_configuration._maxInFlightRequests);
+      }
+      if (_configuration._maxHostConnections || _configuration._maxTotalConnections) {
+        _communicator->limitConnections(_configuration._maxHostConnections, _configuration._maxTotalConnections);
+      }
     }
 
 HttpConnection::~HttpConnection(){
@@ -48,6 +54,9 @@ MessageID HttpConnection::sendRequest(std::unique_ptr<Request> request,
                                  OnErrorCallback onError,
                                  OnSuccessCallback onSuccess){
   Callbacks callbacks(onSuccess, onError);
+  if(request->timeout() == std::chrono::milliseconds(0)){
+    request->timeout(_configuration._requestTimeout);
+  }
 
   std::string dbString = (request->header.database) ? std::string("/_db/") + request->header.database.get() : std::string("");
   Destination destination = (_configuration._ssl ? "https://" : "http://")
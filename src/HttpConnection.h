@@ -51,6 +51,10 @@ class HttpConnection : public ConnectionInterface {
   std::size_t requestsLeft() override {
     return _communicator->requestsLeft();
   }
+
+  void cancel(MessageID id) override {
+    _communicator->cancelRequest(id);
+  }
  private:
   std::shared_ptr<HttpCommunicator> _communicator;
   detail::ConnectionConfiguration _configuration;
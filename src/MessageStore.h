@@ -0,0 +1,172 @@
+////////////////////////////////////////////////////////////////////////////////
+/// DISCLAIMER
+///
+/// Copyright 2016 ArangoDB GmbH, Cologne, Germany
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+///
+/// Copyright holder is ArangoDB GmbH, Cologne, Germany
+///
+/// @author Jan Christoph Uhde
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#ifndef ARANGO_CXX_DRIVER_MESSAGE_STORE_H
+#define ARANGO_CXX_DRIVER_MESSAGE_STORE_H 1
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <fuerte/types.h>
+
+namespace arangodb { namespace fuerte { inline namespace v1 {
+
+// Store of in-flight messages: a ring of slots indexed by `messageId & mask`
+// and a small overflow map.
+//
+// Message ids of a connection are handed out in increasing order, so the
+// messages in flight at the same time map to different slots as long as
+// fewer ids than slots are in use. The id of the item in a slot tells which
+// message holds it and is compared on lookup. A message whose slot is still
+// held by an older message goes to the overflow map - the ring never grows.
+// Items must provide a `_messageId` member.
+//
+// Modifications are serialized by a mutex. find() loads the slot atomically
+// and only locks when the overflow map is in use. As it may see an item that
+// has just been removed, erase() decides who completes a message: only the
+// caller that gets the item back from erase() may call its callbacks.
+template<typename T>
+class MessageStore {
+public:
+  using ItemSP = std::shared_ptr<T>;
+
+  explicit MessageStore(std::size_t capacity = 1024)
+    : _slots(roundUp(capacity))
+    , _mask(_slots.size() - 1)
+    , _ringSize(0)
+    , _overflowSize(0)
+    {}
+
+  // adds an item - its id must not be in the store
+  void add(ItemSP item){
+    std::lock_guard<std::mutex> lock(_mutex);
+    MessageID id = item->_messageId;
+    auto& slot = _slots[id & _mask];
+    if(std::atomic_load(&slot)){
+      _overflow.emplace(id, std::move(item));
+      ++_overflowSize;
+    } else {
+      std::atomic_store(&slot, std::move(item));
+      ++_ringSize;
+    }
+  }
+
+  // returns the item with the given id or nullptr
+  ItemSP find(MessageID id) const {
+    auto item = std::atomic_load(&_slots[id & _mask]);
+    if(item && item->_messageId == id){
+      return item;
+    }
+    if(_overflowSize == 0){
+      return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto found = _overflow.find(id);
+    return found == _overflow.end() ? nullptr : found->second;
+  }
+
+  // removes the item with the given id and returns it - nullptr
+  // if it is not (or no longer) in the store
+  ItemSP erase(MessageID id){
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto& slot = _slots[id & _mask];
+    auto item = std::atomic_load(&slot);
+    if(item && item->_messageId == id){
+      std::atomic_store(&slot, ItemSP());
+      --_ringSize;
+      return item;
+    }
+    auto found = _overflow.find(id);
+    if(found == _overflow.end()){
+      return nullptr;
+    }
+    item = std::move(found->second);
+    _overflow.erase(found);
+    --_overflowSize;
+    return item;
+  }
+
+  // removes all items and returns them
+  std::vector<ItemSP> clear(){
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto items = collect(true);
+    _ringSize = 0;
+    _overflowSize = 0;
+    return items;
+  }
+
+  // returns all items without removing them
+  std::vector<ItemSP> items(){
+    std::lock_guard<std::mutex> lock(_mutex);
+    return collect(false);
+  }
+
+  std::size_t size() const { return _ringSize + _overflowSize; }
+  bool empty() const { return size() == 0; }
+  std::size_t capacity() const { return _slots.size(); }
+
+private:
+  static std::size_t roundUp(std::size_t capacity){
+    std::size_t rv = 1;
+    while(rv < capacity){ rv <<= 1; }
+    return rv;
+  }
+
+  // the scan of the ring stops once all of its items have been seen
+  std::vector<ItemSP> collect(bool remove){
+    std::vector<ItemSP> items;
+    items.reserve(size());
+    std::size_t left = _ringSize;
+    for(auto it = _slots.begin(); left && it != _slots.end(); ++it){
+      auto item = std::atomic_load(&*it);
+      if(!item){
+        continue;
+      }
+      if(remove){
+        std::atomic_store(&*it, ItemSP());
+      }
+      items.push_back(std::move(item));
+      --left;
+    }
+    for(auto& entry : _overflow){
+      items.push_back(entry.second);
+    }
+    if(remove){
+      _overflow.clear();
+    }
+    return items;
+  }
+
+  mutable std::mutex _mutex;
+  std::vector<ItemSP> _slots;
+  std::size_t const _mask;
+  std::atomic_size_t _ringSize;
+  std::atomic_size_t _overflowSize;
+  std::unordered_map<MessageID, ItemSP> _overflow; // items whose slot is taken
+};
+
+}}}
+#endif
@@ -0,0 +1,135 @@
+////////////////////////////////////////////////////////////////////////////////
+/// DISCLAIMER
+///
+/// Copyright 2016 ArangoDB GmbH, Cologne, Germany
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+///
+/// Copyright holder is ArangoDB GmbH, Cologne, Germany
+///
+/// @author Jan Christoph Uhde
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#ifndef ARANGO_CXX_DRIVER_TIMER_WHEEL_H
+#define ARANGO_CXX_DRIVER_TIMER_WHEEL_H 1
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <fuerte/types.h>
+
+namespace arangodb { namespace fuerte { inline namespace v1 {
+
+// Hashed timer wheel for message timeouts.
+//
+// Time is divided into ticks of the given resolution. An entry expiring in
+// tick t is stored in slot t % slots, entries of later rounds share the slot
+// and keep their tick to tell them apart. add() returns the tick that is
+// needed to remove the entry again. The wheel is not synchronized.
+class TimerWheel {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  TimerWheel(Clock::duration resolution, std::size_t slots)
+    : _resolution(resolution)
+    , _start(Clock::now())
+    , _current(0)
+    , _slots(slots)
+    , _size(0)
+    {}
+
+  // adds an entry and returns its tick (always > 0)
+  uint64_t add(MessageID id, Clock::time_point expires){
+    uint64_t tick = _current + 1;
+    if(expires > _start){
+      // round up - entries must not expire early
+      tick = std::max(tick, static_cast<uint64_t>((expires - _start + _resolution - Clock::duration(1)) / _resolution));
+    }
+    _slots[tick % _slots.size()].push_back(Entry{id, tick});
+    ++_size;
+    return tick;
+  }
+
+  void remove(MessageID id, uint64_t tick){
+    auto& slot = _slots[tick % _slots.size()];
+    for(auto it = slot.begin(); it != slot.end(); ++it){
+      if(it->id == id && it->tick == tick){
+        *it = slot.back();
+        slot.pop_back();
+        --_size;
+        return;
+      }
+    }
+  }
+
+  // removes all entries that expire until now and returns their ids
+  std::vector<MessageID> advance(Clock::time_point now){
+    std::vector<MessageID> expired;
+    uint64_t nowTick = static_cast<uint64_t>((now - _start) / _resolution);
+    if(nowTick <= _current){
+      return expired;
+    }
+    // every slot has to be visited at most once
+    uint64_t first = std::max(_current + 1, nowTick + 1 - std::min<uint64_t>(nowTick, _slots.size()));
+    for(uint64_t tick = first; tick <= nowTick && _size; ++tick){
+      auto& slot = _slots[tick % _slots.size()];
+      for(std::size_t i = 0; i < slot.size();){
+        if(slot[i].tick <= nowTick){
+          expired.push_back(slot[i].id);
+          slot[i] = slot.back();
+          slot.pop_back();
+          --_size;
+        } else {
+          ++i;
+        }
+      }
+    }
+    _current = nowTick;
+    return expired;
+  }
+
+  // point in time of the next slot that contains entries - entries in that
+  // slot might belong to a later round
+  Clock::time_point nextExpiry() const {
+    for(uint64_t tick = _current + 1; tick <= _current + _slots.size(); ++tick){
+      if(!_slots[tick % _slots.size()].empty()){
+        return timeOf(tick);
+      }
+    }
+    return timeOf(_current + _slots.size());
+  }
+
+  Clock::time_point timeOf(uint64_t tick) const {
+    return _start + _resolution * static_cast<Clock::rep>(tick);
+  }
+
+  bool empty() const { return _size == 0; }
+  std::size_t size() const { return _size; }
+
+private:
+  struct Entry {
+    MessageID id;
+    uint64_t tick;
+  };
+
+  Clock::duration _resolution;
+  Clock::time_point _start;
+  uint64_t _current; // last tick that has been processed
+  std::vector<std::vector<Entry>> _slots;
+  std::size_t _size;
+};
+
+}}}
+#endif
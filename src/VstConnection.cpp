@@ -24,13 +24,15 @@
 
 #include "VstConnection.h"
 #include <boost/asio/connect.hpp>
-#include <boost/asio/read.hpp>
 #include <boost/asio/write.hpp>
+#include <algorithm>
 #include <condition_variable>
+#include <cstring>
 #include <fuerte/FuerteLogger.h>
 #include <fuerte/helper.h>
 #include <fuerte/loop.h>
 #include <fuerte/message.h>
+#include <fuerte/requests.h>
 #include <fuerte/vst.h>
 
 namespace arangodb { namespace fuerte { inline namespace v1 { namespace vst {
@@ -44,9 +46,13 @@ using be = ::boost::asio::ip::tcp::endpoint;
 using BoostEC = ::boost::system::error_code;
 using RequestItemSP = std::shared_ptr<RequestItem>;
 using Lock = std::lock_guard<std::mutex>;
+using WriteBatch = VstConnection::WriteBatch;
 typedef std::unique_ptr<Request> RequestUP;
 typedef std::unique_ptr<Response> ResponseUP;
 
+constexpr std::size_t VstConnection::maxWriteBatchSize;
+constexpr std::size_t VstConnection::minReceiveSlabSize;
+
 MessageID VstConnection::sendRequest(std::unique_ptr<Request> request
                                     ,OnErrorCallback onError
                                     ,OnSuccessCallback onSuccess){
@@ -55,62 +61,84 @@ MessageID VstConnection::sendRequest(std::unique_ptr<Request> request
   request->messageid = ++_messageId;
   auto item = std::make_shared<RequestItem>();
 
-  item->_messageId = _messageId;
+  item->_messageId = request->messageid;
   item->_onError = onError;
   item->_onSuccess = onSuccess;
-  item->_requestBuffer = vst::toNetwork(*request);
+  item->_requestBuffer = vst::toNetwork(*request, _configuration._maxChunkSize, _vstVersionID);
+  item->_idempotent = request->idempotent();
+  item->_onChunk = request->onChunk();
+  item->_requestLength = item->_requestBuffer->byteSize();
+  auto timeout = request->timeout();
   item->_request = std::move(request);
+  MessageID messageId = item->_messageId; // item must not be touched after push
 
-  //start Write may be only entered once!
-  bool doWrite;
-  {
-    Lock lockQueue(_sendQueueMutex);
-    doWrite = _sendQueue.empty();
-    _sendQueue.push_back(item);
+  if(!admit(*item)){
+    FUERTE_LOG_DEBUG << "too many requests in flight, rejecting messageid: " << messageId << std::endl;
+    item->_onError(errorToInt(ErrorCondition::QueueFull),std::move(item->_request),nullptr);
+    return messageId;
+  }
+
+  // the store holds every request until it is completed - requests that
+  // are removed before they are written are skipped by the writer
+  _messageStore.add(item);
+  if(timeout == std::chrono::milliseconds(0)){
+    timeout = _configuration._requestTimeout;
+  }
+  if(timeout > std::chrono::milliseconds(0)){
+    addTimeout(*item, timeout);
+  }
+
+  // the queue holds a pointer to a shared_ptr as lock-free queues
+  // are restricted to trivial types
+  auto queued = new RequestItemSP(std::move(item));
+  if(!_sendQueue.push(queued)){
+    delete queued;
+    takeItem(messageId);
+    throw std::runtime_error("unable to queue request");
+  }
 #if ENABLE_FUERTE_LOG_CALLBACKS < 0
-    FUERTE_LOG_DEBUG << "queue request" << std::endl;
+  FUERTE_LOG_DEBUG << "queue request" << std::endl;
 #endif
-    FUERTE_LOG_CALLBACKS << "q";
-  }
+  FUERTE_LOG_CALLBACKS << "q";
 
-  if(doWrite){
-    // this allows sendRequest to return immediately and
-    // not to block until all writing is done
-    if(_connected){
+  // this allows sendRequest to return immediately and
+  // not to block until all writing is done
+  if(_connected){
+    //start Write may be only entered once!
+    if(!_writeScheduled.exchange(true)){
       FUERTE_LOG_VSTTRACE << "queue write" << std::endl;
-      FUERTE_LOG_VSTTRACE << "messageid: " << item->_request->messageid << " path: " << item->_request->header.path.get() << std::endl;
+      FUERTE_LOG_VSTTRACE << "messageid: " << messageId << std::endl;
       auto self = shared_from_this();
-      _ioService->dispatch( [this,self](){ startWrite(); } );
-      //startWrite();
-
-      bool alreadyReading = _reading.exchange(true);
-      if (!alreadyReading){
-        FUERTE_LOG_TRACE << "starting new read" << std::endl;
-        startRead();
-      } else {
-        FUERTE_LOG_TRACE << "NOT starting new read" << std::endl;
-      }
+      _ioService->post( [this,self](){ startWrite(); } );
     }
+
+    bool alreadyReading = _reading.exchange(true);
+    if (!alreadyReading){
+      FUERTE_LOG_TRACE << "starting new read" << std::endl;
+      startRead();
+    } else {
+      FUERTE_LOG_TRACE << "NOT starting new read" << std::endl;
+    }
+  } else if(_connectFailed.exchange(false)){
+    // no host could be reached before - try again for this request
+    auto self = shared_from_this();
+    _ioService->post( [this,self](){ initSocket(); } );
   }
-  return item->_messageId;
+  return messageId;
 }
 
 std::size_t VstConnection::requestsLeft(){
-  // this function does not return the exact size (both mutexes would be
-  // required to be locked at the same time) but as it is used to decide
-  // if another run is called or not this should not be critical.
-  std::size_t left = 0;
-  {
-    Lock sendQueueLock(_sendQueueMutex);
-    left += _sendQueue.size();
-  }
+  // queued requests and requests waiting for their response
+  return _messageStore.size();
+};
 
-  {
-    Lock mapLock(_mapMutex);
-    left += _messageMap.size();
+void VstConnection::cancel(MessageID id){
+  auto item = takeItem(id);
+  if(item){
+    FUERTE_LOG_VSTTRACE << "canceled request, messageid: " << id << std::endl;
+    item->_onError(errorToInt(ErrorCondition::Canceled),std::move(item->_request),nullptr);
   }
-  return left;
-};
+}
 
 std::unique_ptr<Response> VstConnection::sendRequest(RequestUP request){
   FUERTE_LOG_VSTTRACE << "start sync request" << std::endl;
@@ -148,174 +176,571 @@ std::unique_ptr<Response> VstConnection::sendRequest(RequestUP request){
 
 VstConnection::VstConnection(ConnectionConfiguration const& configuration)
     : _asioLoop(getProvider().getAsioLoop())
-    , _messageId(0)
+    , _configuration(configuration)
+    , _messageId(configuration._messageIdBase)
     , _ioService(_asioLoop->getIoService())
     , _socket(nullptr)
     , _context(bs::context::method::sslv23)
     , _sslSocket(nullptr)
+    , _sslSessionHost(0)
+    , _strand(*_ioService)
+    , _resolver(*_ioService)
+    , _hostIndex(0)
+    , _endpointIndex(0)
+    , _connectAttempt(0)
+    , _deadline(*_ioService)
+    , _reconnectTimer(*_ioService)
+    , _reconnectAttempt(0)
+    , _connectFailed(false)
+    , _generation(0)
+    , _writeGeneration(0)
+    , _writePreamble(false)
     , _connected(false)
     , _pleaseStop(false)
     , _reading(false)
-    , _configuration(configuration)
-    , _deadline(*_ioService)
-    , _vstVersionID(1)
+    , _receiveBuffer(std::make_shared<std::vector<uint8_t>>(_configuration._receiveBufferSize))
+    , _receiveSlabSize(_configuration._receiveBufferSize)
+    , _receiveOffered(0)
+    , _readGeneration(0)
+    , _receiveBegin(0)
+    , _receiveEnd(0)
+    , _writeScheduled(false)
+    , _sendQueue(128)
+    , _authenticationId(0)
+    , _inFlightRequests(0)
+    , _inFlightBytes(0)
+    , _notifyReady(false)
+    , _timeouts(std::chrono::milliseconds(10), 1024)
+    , _timeoutTimer(*_ioService)
+    , _timeoutTimerArmed(false)
+    , _vstVersionID(static_cast<int>(_configuration._vstVersion))
 {
-    bt::resolver resolver(*_ioService);
-
-    //TODO async resolve - set other endpoints
-    _endpoints = resolver.resolve({configuration._host,configuration._port});
-    if (_endpoints == bt::resolver::iterator()){
-      throw std::runtime_error("unable to resolve endpoints");
+    _hosts.emplace_back(configuration._host, configuration._port);
+    _hosts.insert(_hosts.end(), configuration._failoverHosts.begin(), configuration._failoverHosts.end());
+    if(configuration._adaptiveInFlight){
+      _limiter.reset(new ConcurrencyLimiter(ConcurrencyLimiter::forMaxInFlight(configuration._maxInFlightRequests)));
+    }
+    if(configuration._ssl){
+      // sessions are handed to newSslSession() - with tls 1.3 they are
+      // only known after the server sent its tickets
+      SSL_CTX* ctx = _context.native_handle();
+      SSL_CTX_set_ex_data(ctx, sslContextIndex(), this); // app data belongs to asio
+      SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+      SSL_CTX_sess_set_new_cb(ctx, &VstConnection::newSslSession);
     }
-
     //initSocket(); -- make_shared_from_this not allowed in constructor -- called after creation
 }
 
+VstConnection::~VstConnection(){
+  // free requests that have never been adopted by the writer
+  RequestItemSP* item;
+  while(_sendQueue.pop(item)){
+    delete item;
+  }
+}
+
 // CONNECT RECONNECT //////////////////////////////////////////////////////////
 
 void VstConnection::initSocket(){
   FUERTE_LOG_CALLBACKS << "begin init" << std::endl;
-  _socket.reset(new bt::socket(*_ioService));
-  _sslSocket.reset(new bs::stream<bt::socket&>(*_socket, _context));
-  _pleaseStop = false;
-  auto endpoints = _endpoints; //copy as connect modifies iterator
-  startConnect(endpoints);
+  _hostIndex = 0;
+  _reconnectAttempt = 0;
+  startResolve();
 }
 
 void VstConnection::shutdownSocket(){
-  std::unique_lock<std::mutex> queueLock(_sendQueueMutex, std::defer_lock);
-  std::unique_lock<std::mutex> mapLock(_mapMutex, std::defer_lock);
-  std::lock(queueLock,mapLock);
-
   FUERTE_LOG_CALLBACKS << "begin shutdown socket" << std::endl;
 
   _deadline.cancel();
+  // the reader and the writer load the sockets concurrently
+  auto sslSocket = std::atomic_exchange(&_sslSocket, SslSocketSP());
+  auto socket = std::atomic_exchange(&_socket, SocketSP());
+  if(!socket){
+    return;
+  }
   BoostEC error;
-  _sslSocket->shutdown(error);
-  _socket->shutdown(bt::socket::shutdown_both,error);
-  _socket->close(error);
-  _sslSocket = nullptr;
-  _socket = nullptr;
+  if(_configuration._ssl){
+    // there is no close_notify - waiting for the answer of the peer would
+    // block this thread. Marking the tls connection as shut down keeps
+    // openssl from invalidating its session, which is resumed on reconnect.
+    SSL_set_shutdown(sslSocket->native_handle(), SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+  }
+  socket->shutdown(bt::socket::shutdown_both,error);
+  socket->close(error);
 }
 
-void VstConnection::shutdownConnection(){
+void VstConnection::failAllRequests(ErrorCondition error){
+  auto items = _messageStore.clear();
+  for(auto& item : items){
+    release(*item);
+    feedback(*item, false);
+  }
+  {
+    Lock lock(_timeoutMutex);
+    for(auto& item : items){
+      if(item->_timeoutTick){
+        _timeouts.remove(item->_messageId, item->_timeoutTick);
+      }
+    }
+    if(_timeouts.empty() && _timeoutTimerArmed){
+      _timeoutTimerArmed = false;
+      _timeoutTimer.cancel();
+    }
+  }
+  for(auto& item : items){
+    item->_onError(errorToInt(error)
+                  ,std::move(item->_request)
+                  ,nullptr);
+  }
+}
+
+void VstConnection::restartConnection(){
   // this function must be used in handlers
+  // the read loop is released by the reader when its handler sees the new
+  // generation - restarting from the writer must not let a second reader
+  // work on the receive buffer
   bool alreadyStopping = _pleaseStop.exchange(true);
-  _reading = false;
+  _connected = false;
   if (alreadyStopping){
     return;
   }
 
-  FUERTE_LOG_CALLBACKS << "begin shutdown connection" << std::endl;
-  shutdownSocket();
+  FUERTE_LOG_CALLBACKS << "restart" << std::endl;
 
-  Lock mapLock(_mapMutex);
-  for(auto& item : _messageMap){
-    item.second->_onError(errorToInt(ErrorCondition::VstCanceldDuringReset)
-                         ,std::move(item.second->_request)
-                         ,nullptr);
+  // Requests that have not been written completely are sent again by the
+  // writer. Requests that have been written (or were part of a failed write)
+  // may have been executed by the server - only idempotent ones are sent
+  // again, the others are failed. So are streamed requests that delivered
+  // part of their body.
+  std::vector<RequestItemSP> failed;
+  {
+    Lock lock(_replayMutex);
+    ++_generation;
+    // the new connection authenticates with a message of its own
+    _authentication.reset();
+    if(_authenticationId){
+      takeItem(_authenticationId);
+      _authenticationId = 0;
+    }
+    for(auto& item : _messageStore.items()){
+      if(!item->_written){
+        continue;
+      }
+      if(item->replayable()){
+        item->_written = false;
+        item->resetResponse();
+        _replayQueue.push_back(std::move(item));
+      } else if(takeItem(item->_messageId)){
+        failed.push_back(std::move(item));
+      }
+    }
+  }
+  // handlers of the old socket see the new generation
+  shutdownSocket();
+  for(auto& item : failed){
+    item->_onError(errorToInt(ErrorCondition::VstCanceldDuringReset)
+                  ,std::move(item->_request)
+                  ,nullptr);
   }
-  _messageMap.clear();
 
+  initSocket();
 }
 
-void VstConnection::restartConnection(){
-  FUERTE_LOG_CALLBACKS << "restart" << std::endl;
-  shutdownConnection();
-  initSocket();
+void VstConnection::closeConnection(ErrorCondition error){
+  // this function must be used in handlers
+  bool alreadyStopping = _pleaseStop.exchange(true);
+  _connected = false;
+  if (alreadyStopping){
+    return;
+  }
+
+  FUERTE_LOG_CALLBACKS << "close" << std::endl;
+  {
+    Lock lock(_replayMutex);
+    ++_generation; // the writer drops the failed requests
+    _authentication.reset();
+    if(_authenticationId){
+      takeItem(_authenticationId);
+      _authenticationId = 0;
+    }
+    _replayQueue.clear();
+  }
+  shutdownSocket();
+  _connectFailed = true;
+  failAllRequests(error);
 }
 
 // ASIO CONNECT
 
-void VstConnection::startConnect(bt::resolver::iterator endpointItr){
-  if (endpointItr != boost::asio::ip::tcp::resolver::iterator()){
-    FUERTE_LOG_CALLBACKS << "trying to connect to: " << endpointItr->endpoint() << "..." << std::endl;
+void VstConnection::startResolve(){
+  if(_hostIndex == _hosts.size()){
+    _deadline.cancel();
+    if(_reconnectAttempt < _configuration._reconnectAttempts){
+      auto delay = _configuration._reconnectDelay * (1u << std::min(_reconnectAttempt, 16u));
+      ++_reconnectAttempt;
+      FUERTE_LOG_ERROR << "unable to connect to any endpoint - retrying in "
+                       << delay.count() << "ms" << std::endl;
+      auto self = shared_from_this();
+      _reconnectTimer.expires_from_now(delay);
+      _reconnectTimer.async_wait([this,self](BoostEC const& error){
+        if(!error){
+          _hostIndex = 0;
+          startResolve();
+        }
+      });
+      return;
+    }
+    FUERTE_LOG_ERROR << "unable to connect to any endpoint" << std::endl;
+    // the next request starts over - set before failing so that
+    // requests queued meanwhile are not left behind
+    _connectFailed = true;
+    failAllRequests(ErrorCondition::CouldNotConnect);
+    return;
+  }
 
-    // Set a deadline for the connect operation.
-    _deadline.expires_from_now(boost::posix_time::seconds(60));
+  auto const& host = _hosts[_hostIndex];
+  FUERTE_LOG_CALLBACKS << "resolving: " << host.first << ":" << host.second << std::endl;
+  auto self = shared_from_this();
+  _resolver.async_resolve(bt::resolver::query(host.first, host.second)
+                         ,[this,self](BoostEC const& error, bt::resolver::iterator it){
+                            handleResolve(error, it);
+                          }
+                         );
+}
 
-    // Start the asynchronous connect operation.
-    auto self = shared_from_this();
-    ba::async_connect(*_socket
-                     ,endpointItr
-                     ,[this,self](BoostEC const& error, bt::resolver::iterator endpointItr){
-                        handleConnect(error,endpointItr);
-                      }
-                     );
-  }
-}
-
-void VstConnection::handleConnect(BoostEC const& error, bt::resolver::iterator endpointItr){
-  if(!error){
-    FUERTE_LOG_CALLBACKS << "connected" << std::endl;
-    //if success - start async handshake
-    if(_configuration._ssl){
-      FUERTE_LOG_CALLBACKS << "call start startHandshake" << std::endl;
-      startHandshake();
-      return;
+void VstConnection::handleResolve(BoostEC const& error, bt::resolver::iterator it){
+  if(error){
+    FUERTE_LOG_ERROR << "unable to resolve endpoint -- " << error.message() << std::endl;
+    ++_hostIndex;
+    startResolve();
+    return;
+  }
+
+  // alternate between address families (happy eyeballs) so an unreachable
+  // family does not delay the connection by all of its addresses
+  std::vector<be> first, second;
+  bool v6First = it->endpoint().address().is_v6();
+  for(; it != bt::resolver::iterator(); ++it){
+    if(it->endpoint().address().is_v6() == v6First){
+      first.push_back(it->endpoint());
     } else {
-      FUERTE_LOG_CALLBACKS << "call finish init" << std::endl;
-      finishInitialization();
-      return;
+      second.push_back(it->endpoint());
     }
-  } else {
-    FUERTE_LOG_ERROR << error.message() << std::endl;
-    shutdownConnection();
-    if(endpointItr == bt::resolver::iterator()){
-      FUERTE_LOG_CALLBACKS << "no further endpoint" << std::endl;
+  }
+  _endpointList.clear();
+  for(std::size_t i = 0; i < std::max(first.size(), second.size()); ++i){
+    if(i < first.size()){ _endpointList.push_back(first[i]); }
+    if(i < second.size()){ _endpointList.push_back(second[i]); }
+  }
+  _endpointIndex = 0;
+  startConnect();
+}
+
+void VstConnection::startConnect(){
+  if(_endpointIndex == _endpointList.size()){
+    // all addresses of this host failed - try the next one
+    ++_hostIndex;
+    startResolve();
+    return;
+  }
+
+  auto const& endpoint = _endpointList[_endpointIndex];
+  FUERTE_LOG_CALLBACKS << "trying to connect to: " << endpoint << "..." << std::endl;
+  auto socket = std::make_shared<bt::socket>(*_ioService);
+  auto sslSocket = std::make_shared<bs::stream<bt::socket&>>(*socket, _context);
+  auto session = std::atomic_load(&_sslSession);
+  if(_configuration._ssl && session && _sslSessionHost == _hostIndex){
+    SSL_set_session(sslSocket->native_handle(), session.get());
+  }
+  std::atomic_store(&_socket, socket);
+  std::atomic_store(&_sslSocket, sslSocket);
+
+  // Set a deadline for the connect operation (including the ssl handshake).
+  // The socket of a timed out attempt is closed so its handler fails.
+  auto self = shared_from_this();
+  auto attempt = ++_connectAttempt;
+  _deadline.expires_from_now(boost::posix_time::milliseconds(_configuration._connectTimeout.count()));
+  _deadline.async_wait([this,self,socket,attempt](BoostEC const& error){
+    if(!error && attempt == _connectAttempt && !_connected){
+      FUERTE_LOG_ERROR << "connect attempt timed out" << std::endl;
+      BoostEC ec;
+      socket->close(ec);
     }
-    throw std::runtime_error("unable to connect -- " + error.message() );
+  });
+
+  // Start the asynchronous connect operation.
+  socket->async_connect(endpoint
+                        ,[this,self](BoostEC const& error){
+                           handleConnect(error);
+                         }
+                        );
+}
+
+void VstConnection::handleConnect(BoostEC const& error){
+  if(error){
+    FUERTE_LOG_ERROR << "unable to connect -- " << error.message() << std::endl;
+    ++_endpointIndex;
+    startConnect();
     return;
   }
-  throw std::logic_error("you should not end up here!!!");
+
+  FUERTE_LOG_CALLBACKS << "connected" << std::endl;
+  //if success - start async handshake
+  if(_configuration._ssl){
+    FUERTE_LOG_CALLBACKS << "call start startHandshake" << std::endl;
+    startHandshake();
+  } else {
+    FUERTE_LOG_CALLBACKS << "call finish init" << std::endl;
+    finishInitialization();
+  }
 }
 
 void VstConnection::finishInitialization(){
   FUERTE_LOG_CALLBACKS << "finish initialization" << std::endl;
-  {
-    _connected = true;
+  queueAuthentication(); // before the writer may use the new connection
+  _pleaseStop = false;
+  _connected = true;
+  _deadline.cancel();
+  if(!_writeScheduled.exchange(true)){
+    startWrite(); // there might be no requests enqueued
   }
-  startWrite(true); // there might be no requests enqueued
   bool alreadyReading = _reading.exchange(true);
   if (!alreadyReading){
     startRead();
   }
 }
 
+void VstConnection::queueAuthentication(){
+  RequestItemSP item;
+  if(!_configuration._user.empty()){
+    auto request = createAuthenticationRequest(_configuration._user, _configuration._password);
+    request->messageid = ++_messageId;
+    item = std::make_shared<RequestItem>();
+    item->_messageId = request->messageid;
+    // requests must not be sent on a connection that has been rejected.
+    // The item is owned by the connection - it must not keep it alive.
+    std::weak_ptr<VstConnection> weak = shared_from_this();
+    item->_onError = [weak](Error error, RequestUP, ResponseUP){
+      FUERTE_LOG_ERROR << "authentication failed: " << to_string(intToError(error)) << std::endl;
+      if(auto self = weak.lock()){
+        self->closeConnection(ErrorCondition::VstUnauthorized);
+      }
+    };
+    item->_onSuccess = [weak](RequestUP, ResponseUP response){
+      auto const& code = response->header.responseCode;
+      if(!code || code.get() < 200 || code.get() >= 300){
+        FUERTE_LOG_ERROR << "authentication failed with code: " << (code ? code.get() : 0) << std::endl;
+        if(auto self = weak.lock()){
+          self->closeConnection(ErrorCondition::VstUnauthorized);
+        }
+      }
+    };
+    item->_requestBuffer = vst::toNetwork(*request, _configuration._maxChunkSize, _vstVersionID);
+    item->_request = std::move(request);
+    _messageStore.add(item);
+    if(_configuration._requestTimeout > std::chrono::milliseconds(0)){
+      addTimeout(*item, _configuration._requestTimeout);
+    }
+  }
+
+  // the writer sends the message before all requests of the new connection.
+  // These follow without waiting for the response - the server handles the
+  // messages of a connection in order.
+  Lock lock(_replayMutex);
+  _authentication = std::move(item);
+  _authenticationId = _authentication ? _authentication->_messageId : 0;
+  ++_generation;
+}
+
+int VstConnection::sslContextIndex(){
+  static int const index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+  return index;
+}
+
+int VstConnection::newSslSession(SSL* ssl, SSL_SESSION* session){
+  // keep the latest session so that a reconnect can resume it
+  // instead of doing a full handshake
+  auto self = static_cast<VstConnection*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), sslContextIndex()));
+  self->_sslSessionHost = self->_hostIndex;
+  std::atomic_store(&self->_sslSession, std::shared_ptr<SSL_SESSION>(session, SSL_SESSION_free));
+  return 1; // we own the reference
+}
+
 void VstConnection::startHandshake(){
   if(!_configuration._ssl){
     finishInitialization();
+    return;
   }
   FUERTE_LOG_CALLBACKS << "starting ssl handshake " << std::endl;
   auto self = shared_from_this();
-  _sslSocket->async_handshake(bs::stream_base::client
-                             ,[this,self](BoostEC const& error){
+  auto sslSocket = std::atomic_load(&_sslSocket);
+  sslSocket->async_handshake(bs::stream_base::client
+                             ,[this,self,sslSocket](BoostEC const& error){
                                if(error){
-                                 shutdownSocket();
-                                 FUERTE_LOG_ERROR << error.message() << std::endl;
-                                 throw std::runtime_error("unable to perform ssl handshake");
+                                 FUERTE_LOG_ERROR << "unable to perform ssl handshake -- " << error.message() << std::endl;
+                                 ++_endpointIndex;
+                                 startConnect();
+                                 return;
                                }
                                FUERTE_LOG_CALLBACKS << "ssl handshake done" << std::endl ;
+                               if(SSL_session_reused(sslSocket->native_handle())){
+                                 FUERTE_LOG_DEBUG << "ssl session resumed" << std::endl;
+                               }
                                finishInitialization();
                               }
                             );
 
 }
 
+// TIMEOUTS //////////////////////////////////////////////////////////////////
+
+bool VstConnection::admit(RequestItem& item){
+  item._sendTime = std::chrono::steady_clock::now();
+  if(!_limiter && !_configuration._maxInFlightRequests && !_configuration._maxInFlightBytes){
+    return true;
+  }
+  auto hasRoom = [&]{
+    return _inFlightRequests == 0 || hasCapacity(item._requestLength);
+  };
+  std::unique_lock<std::mutex> lock(_capacityMutex);
+  if(!hasRoom()){
+    if(_configuration._backpressurePolicy != BackpressurePolicy::Block){
+      _notifyReady = _configuration._backpressurePolicy == BackpressurePolicy::Notify;
+      return false;
+    }
+    _capacityCondition.wait(lock, hasRoom);
+  }
+  ++_inFlightRequests;
+  _inFlightBytes += item._requestLength;
+  item._admitted = true;
+  return true;
+}
+
+void VstConnection::release(RequestItem const& item){
+  if(!item._admitted){
+    return; // no limits or internal request
+  }
+  bool ready = false;
+  {
+    Lock lock(_capacityMutex);
+    --_inFlightRequests;
+    _inFlightBytes -= item._requestLength;
+    // the same check as admit for the smallest possible request
+    if(_notifyReady && hasCapacity(1)){
+      _notifyReady = false;
+      ready = true;
+    }
+  }
+  // waiting requests differ in size - each one checks for itself
+  _capacityCondition.notify_all();
+  if(ready && _configuration._onReady){
+    _configuration._onReady();
+  }
+}
+
+bool VstConnection::hasCapacity(std::size_t requestLength) const {
+  std::size_t maxRequests = _limiter ? _limiter->limit() : _configuration._maxInFlightRequests;
+  return (!maxRequests || _inFlightRequests < maxRequests) &&
+         (!_configuration._maxInFlightBytes ||
+          _inFlightBytes + requestLength <= _configuration._maxInFlightBytes);
+}
+
+void VstConnection::feedback(RequestItem const& item, bool success){
+  if(!_limiter || !item._admitted){
+    return;
+  }
+  {
+    Lock lock(_capacityMutex);
+    if(success){
+      _limiter->onSuccess(std::chrono::steady_clock::now() - item._sendTime);
+    } else {
+      _limiter->onError();
+    }
+  }
+  _capacityCondition.notify_all(); // the limit may have grown
+}
+
+RequestItemSP VstConnection::takeItem(MessageID id){
+  auto item = _messageStore.erase(id);
+  if(item){
+    release(*item);
+  }
+  if(item && item->_timeoutTick){
+    Lock lock(_timeoutMutex);
+    _timeouts.remove(id, item->_timeoutTick);
+    if(_timeouts.empty() && _timeoutTimerArmed){
+      // do not keep the io_service busy without pending requests
+      _timeoutTimerArmed = false;
+      _timeoutTimer.cancel();
+    }
+  }
+  return item;
+}
+
+void VstConnection::addTimeout(RequestItem& item, std::chrono::milliseconds timeout){
+  Lock lock(_timeoutMutex);
+  item._timeoutTick = _timeouts.add(item._messageId, TimerWheel::Clock::now() + timeout);
+  auto expires = _timeouts.timeOf(item._timeoutTick);
+  if(!_timeoutTimerArmed || expires < _timeoutTimer.expires_at()){
+    // (re)arm the timer - an earlier wait is canceled
+    _timeoutTimerArmed = true;
+    startTimeoutTimer(expires);
+  }
+}
+
+void VstConnection::startTimeoutTimer(TimerWheel::Clock::time_point expires){
+  // _timeoutMutex must be held - the timer is shared by all threads
+  std::weak_ptr<VstConnection> weak = shared_from_this(); // pending timeouts must not keep the connection alive
+  _timeoutTimer.expires_at(expires);
+  _timeoutTimer.async_wait([weak](BoostEC const& error){
+    auto self = weak.lock();
+    if(self && error != ba::error::operation_aborted){
+      self->handleTimeout();
+    }
+  });
+}
+
+void VstConnection::handleTimeout(){
+  std::vector<MessageID> expired;
+  {
+    Lock lock(_timeoutMutex);
+    expired = _timeouts.advance(TimerWheel::Clock::now());
+    if(_timeouts.empty()){
+      _timeoutTimerArmed = false;
+    } else {
+      startTimeoutTimer(_timeouts.nextExpiry());
+    }
+  }
+
+  for(auto id : expired){
+    auto item = _messageStore.erase(id);
+    if(item){
+      release(*item);
+      feedback(*item, false);
+      FUERTE_LOG_DEBUG << "request timed out, messageid: " << id << std::endl;
+      item->_onError(errorToInt(ErrorCondition::Timeout),std::move(item->_request),nullptr);
+    }
+  }
+}
+
 // READING WRITING / NORMAL OPERATIONS  ///////////////////////////////////////
 
 void VstConnection::startRead(){
   FUERTE_LOG_CALLBACKS << "-";
   if (_pleaseStop) {
-    return;
+    _reading = false;
+    // the connection may have been established after the check - the
+    // new connection either sees the flag released or we continue
+    if(_pleaseStop || _reading.exchange(true)){
+      return;
+    }
   }
 
-  {
-    std::unique_lock<std::mutex> queueLock(_sendQueueMutex, std::defer_lock);
-    std::unique_lock<std::mutex> mapLock(_mapMutex, std::defer_lock);
-    std::lock(queueLock,mapLock);
-    if(_messageMap.empty() && _sendQueue.empty()){
-      _reading = false;
+  if(_messageStore.empty()){
+    _reading = false;
+    // sendRequest may have queued a request after the check and seen
+    // _reading still set - continue reading for it in that case
+    if(_messageStore.empty() || _reading.exchange(true)){
       FUERTE_LOG_VSTTRACE << "returning from read loop";
       FUERTE_LOG_CALLBACKS <<  std::endl;
       return;
@@ -323,32 +748,125 @@ void VstConnection::startRead(){
   }
 
   // gets data from network and fill
-  _deadline.expires_from_now(boost::posix_time::seconds(30));
   FUERTE_LOG_CALLBACKS << "r";
 #if ENABLE_FUERTE_LOG_CALLBACKS > 0
-  std::cout << mapToKeys(_messageMap) << std::endl;
+  std::cout << "in flight: " << _messageStore.size() << std::endl;
   std::cout.flush();
 #endif
+  // the handler keeps the socket alive - a reset replaces it while
+  // the operation may still be running
+  uint64_t generation = _generation;
+  auto socket = std::atomic_load(&_socket);
+  auto sslSocket = std::atomic_load(&_sslSocket);
+  if(!socket || _pleaseStop || generation != _generation){
+    // reset after the check - the socket may not belong to the generation
+    _reading = false;
+    if(_pleaseStop || _reading.exchange(true)){
+      return;
+    }
+    startRead();
+    return;
+  }
+  if(generation != _readGeneration){
+    // only the reader touches the receive buffer - partial chunks of the
+    // old connection are dropped here instead of during the reset
+    _readGeneration = generation;
+    _receiveBegin = _receiveEnd = 0;
+  }
+  if(!prepareReceiveBuffer()){
+    FUERTE_LOG_ERROR << "chunk exceeds the maximal message size" << std::endl;
+    _reading = false; // the new connection starts its own read loop
+    restartConnection();
+    return;
+  }
   auto self = shared_from_this();
-  ba::async_read(*_socket
-                ,_receiveBuffer
-                ,ba::transfer_at_least(4)
-                ,[this,self](const boost::system::error_code& error, std::size_t transferred){
-                   handleRead(error,transferred);
-                 }
-                );
+  _receiveOffered = _receiveBuffer->size() - _receiveEnd;
+  auto buffer = ba::buffer(_receiveBuffer->data() + _receiveEnd, _receiveOffered);
+  auto handler = [this,self,generation,socket,sslSocket](const boost::system::error_code& error, std::size_t transferred){
+    if(generation != _generation){
+      // read on a socket that has been replaced - hand the read loop over
+      // to the new connection
+      _reading = false;
+      if(!_connected || _reading.exchange(true)){
+        return;
+      }
+      startRead();
+      return;
+    }
+    handleRead(error,transferred);
+  };
+
+  if(_configuration._ssl){
+    // the tls stream must not be used concurrently - reads and writes
+    // (including the handlers of their internal operations) run in _strand
+    _strand.dispatch([this,sslSocket,buffer,handler](){
+      sslSocket->async_read_some(buffer, _strand.wrap(handler));
+    });
+  } else {
+    socket->async_read_some(buffer, handler);
+  }
 }
 
-// helper for turning a asio::const_buffer into a accessible form
-template<typename T = uint8_t>
-std::pair<T const*, std::size_t> bufferToPointerAndSize(boost::asio::const_buffer& buffer){
-  return std::make_pair( boost::asio::buffer_cast<T const*>(buffer)
-                       , boost::asio::buffer_size(buffer));
+bool VstConnection::prepareReceiveBuffer(){
+  std::size_t pending = _receiveEnd - _receiveBegin;
+  std::size_t required = pending + 1;
+  if(pending >= sizeof(uint32_t)){
+    // the length of the next chunk is known - make room for all of it
+    uint32_t chunkLength;
+    // TODO -- fix endianess
+    std::memcpy(&chunkLength, _receiveBuffer->data() + _receiveBegin, sizeof(uint32_t));
+    if(chunkLength > _configuration._maxMessageSize + vst::chunkHeaderLength(_vstVersionID, true, false)){
+      return false; // corrupt - the buffer must not grow for it
+    }
+    required = std::max<std::size_t>(required, chunkLength);
+  }
+
+  std::size_t const capacity = _receiveSlabSize;
+  bool unique = _receiveBuffer.use_count() == 1;
+  if(pending == 0 && unique){
+    _receiveBegin = _receiveEnd = 0;
+    if(_receiveBuffer->size() > capacity && required <= capacity){
+      // the buffer has been grown for an oversized chunk or the reads
+      // return less data than before - shrink it again
+      _receiveBuffer = std::make_shared<std::vector<uint8_t>>(capacity);
+    }
+  }
+  if(_receiveBegin + required <= _receiveBuffer->size()){
+    return true;
+  }
+
+  if(unique && required <= _receiveBuffer->size()){
+    // nobody references the processed data - reuse the buffer
+    std::memmove(_receiveBuffer->data(), _receiveBuffer->data() + _receiveBegin, pending);
+  } else {
+    // responses point into the current buffer or the chunk does not fit
+    auto buffer = std::make_shared<std::vector<uint8_t>>(std::max(required, capacity));
+    std::memcpy(buffer->data(), _receiveBuffer->data() + _receiveBegin, pending);
+    _receiveBuffer = std::move(buffer);
+  }
+  _receiveBegin = 0;
+  _receiveEnd = pending;
+  return true;
+}
+
+void VstConnection::adaptReceiveSlab(std::size_t transferred){
+  std::size_t const max = _configuration._receiveBufferSize;
+  if(transferred == _receiveOffered){
+    // the read filled the buffer - more data may be waiting
+    _receiveSlabSize = std::min(max, _receiveSlabSize * 2);
+    return;
+  }
+  // twice the data of the last read, so that a few of them share a buffer
+  std::size_t size = std::min(max, minReceiveSlabSize);
+  while(size < 2 * transferred && size < max){
+    size *= 2;
+  }
+  _receiveSlabSize = std::min(size, max);
 }
 
 std::tuple<bool,std::shared_ptr<RequestItem>,std::size_t> VstConnection::processChunk(uint8_t const * cursor, std::size_t length){
   FUERTE_LOG_VSTTRACE << "\n\n\nENTER PROCESS CHUNK, address: " << cursor << " length: " <<  length << std::endl;
-  auto vstChunkHeader = vst::readChunkHeaderV1_0(cursor);
+  auto vstChunkHeader = vst::readChunkHeader(_vstVersionID, cursor);
   //peek next chunk
   bool nextChunkAvailable = false;
   if(length > vstChunkHeader._chunkLength + sizeof(ChunkHeader::_chunkLength)){
@@ -371,103 +889,211 @@ std::tuple<bool,std::shared_ptr<RequestItem>,std::size_t> VstConnection::process
   //because we are in single chunk mode for now
   //assert(length == vstChunkHeader._chunkPayloadLength);
 
-  ::std::map<MessageID,std::shared_ptr<RequestItem>>::iterator found;
-  {
-    Lock lock(_mapMutex);
-    found = _messageMap.find(vstChunkHeader._messageID);
-    if (found == _messageMap.end()) {
-      throw std::logic_error("got message with no matching request");
-    }
+  RequestItemSP item = _messageStore.find(vstChunkHeader._messageID);
+  if (!item) {
+    // the request has been completed already (e.g. timeout) - drop the chunk
+    FUERTE_LOG_DEBUG << "discarding chunk of unknown message: " << vstChunkHeader._messageID << std::endl;
+    return std::tuple<bool,RequestItemSP,std::size_t>(nextChunkAvailable, nullptr, vstChunkHeader._chunkLength);
   }
 
-  RequestItemSP item = found->second;
-
-  FUERTE_LOG_VSTTRACE << "appending to item with length: " << vstChunkHeader._chunkPayloadLength << std::endl;
-  // copy payload to buffer
-  item->_responseBuffer.append(cursor,vstChunkHeader._chunkPayloadLength);
-
-  cursor += vstChunkHeader._chunkPayloadLength;
-  length -= vstChunkHeader._chunkPayloadLength;
-
   FUERTE_LOG_VSTTRACE << "next chunk available: " << std::boolalpha << nextChunkAvailable  << std::endl;
 
+  if(item->_onChunk){
+    bool complete = processStreamedChunk(*item, vstChunkHeader, cursor);
+    return std::tuple<bool,RequestItemSP,std::size_t>(nextChunkAvailable, complete ? std::move(item) : nullptr, vstChunkHeader._chunkLength);
+  }
+
   if(vstChunkHeader._isSingle){ //we got a single chunk containing the complete message
     FUERTE_LOG_VSTTRACE << "adding single chunk " << std::endl;
-    FUERTE_LOG_VSTTRACE << "resetting buffer length to: " << vstChunkHeader._chunkPayloadLength << std::endl;
-    item->_responseBuffer.resetTo(vstChunkHeader._chunkPayloadLength);
-    FUERTE_LOG_VSTTRACE << "setting buffer length - done" << vstChunkHeader._chunkPayloadLength << std::endl;
+    if(vstChunkHeader._chunkPayloadLength > _configuration._maxMessageSize){
+      FUERTE_LOG_ERROR << "message exceeds the maximal message size: " << vstChunkHeader._messageID << std::endl;
+      if(takeItem(vstChunkHeader._messageID)){
+        item->_onError(errorToInt(ErrorCondition::VstReadError),std::move(item->_request),nullptr);
+      }
+      return std::tuple<bool,RequestItemSP,std::size_t>(nextChunkAvailable, nullptr, vstChunkHeader._chunkLength);
+    }
+    // no copy - the response references the receive buffer
+    item->_responseData = std::shared_ptr<uint8_t const>(_receiveBuffer, cursor);
+    item->_responseLength = vstChunkHeader._chunkPayloadLength;
     return std::tuple<bool,RequestItemSP,std::size_t>(nextChunkAvailable, std::move(item), vstChunkHeader._chunkLength);
-  } else if (!vstChunkHeader._isFirst){
-    //there is chunk that continues a message
-    assert(item->_responseChunk == vstChunkHeader._numberOfChunks); // 0 based counting
-    item->_responseChunk++;
-    FUERTE_LOG_VSTTRACE << "cunk: " << vstChunkHeader._numberOfChunks << "/" << item->_responseChunks << std::endl;
-    if(item->_responseChunks == item->_responseChunk){ //last chunk reached
-      FUERTE_LOG_VSTTRACE << "adding multi chunk " << std::endl;
-      // TODO TODO TODO TODO should multichunk not be working start looking here!!!!!!!
-      // the VPackBuffer is unable to track how much has been written to it. Maybe this is
-      // fixed when you read this.
-      //assert(item->_responseBuffer.length() == item->_responseLength);
-      item->_responseBuffer.resetTo(item->_responseLength);
-      return std::tuple<bool,RequestItemSP,std::size_t>(nextChunkAvailable, std::move(item),vstChunkHeader._chunkLength);
-    }
-    FUERTE_LOG_VSTTRACE << "multi chunk incomplete" << std::endl;
-  } else {
-    //the chunk stats a multipart message
-    item->_responseLength = vstChunkHeader._totalMessageLength;
-    item->_responseChunks = vstChunkHeader._numberOfChunks;
-    item->_responseChunk = 1;
-    FUERTE_LOG_VSTTRACE << "starting multi chunk" << std::endl;
   }
 
+  FUERTE_LOG_VSTTRACE << "placing chunk of item with length: " << vstChunkHeader._chunkPayloadLength << std::endl;
+  if(!placeChunk(*item, vstChunkHeader, cursor)){
+    FUERTE_LOG_ERROR << "invalid chunk of message: " << vstChunkHeader._messageID << std::endl;
+    if(takeItem(vstChunkHeader._messageID)){
+      item->_onError(errorToInt(ErrorCondition::VstReadError),std::move(item->_request),nullptr);
+    }
+    return std::tuple<bool,RequestItemSP,std::size_t>(nextChunkAvailable, nullptr, vstChunkHeader._chunkLength);
+  }
+
+  if(item->_responseChunk == item->_responseChunks){ //last chunk reached
+    FUERTE_LOG_VSTTRACE << "adding multi chunk " << std::endl;
+    return std::tuple<bool,RequestItemSP,std::size_t>(nextChunkAvailable, std::move(item),vstChunkHeader._chunkLength);
+  }
+  FUERTE_LOG_VSTTRACE << "multi chunk incomplete " << item->_responseChunk << "/" << item->_responseChunks << std::endl;
   return std::tuple<bool,RequestItemSP,std::size_t>(nextChunkAvailable, nullptr, vstChunkHeader._chunkLength);
 }
 
+// Copies the payload of a chunk of a multi chunk message to its place in the
+// response buffer.
+//
+// The first chunk announces the length of the message, so the buffer is
+// allocated once. Chunks are placed in the order of their index at the end of
+// the leading chunks placed so far. Chunks may have different lengths, so
+// the offset of a chunk is only known once all of its predecessors have
+// arrived - chunks that overtook a predecessor (or the first chunk) are
+// copied to _responsePending and copied again when they are placed. Servers
+// send the chunks of a message in order, so this extra copy is accepted for
+// the rare reordered chunk instead of tracking placement with a bitmap.
+// Returns false if the chunk is a duplicate, does not fit into the announced
+// message or the message exceeds the maximal message size.
+bool VstConnection::placeChunk(RequestItem& item, ChunkHeader const& chunkHeader, uint8_t const* payload){
+  std::size_t length = chunkHeader._chunkPayloadLength;
+  if(chunkHeader._isFirst){
+    if(item._responseChunks || chunkHeader._numberOfChunks < 2 || length > chunkHeader._totalMessageLength ||
+       chunkHeader._totalMessageLength > _configuration._maxMessageSize){
+      return false;
+    }
+    item._responseBuffer.clear();
+    item._responseBuffer.reserve(chunkHeader._totalMessageLength);
+    item._responseBuffer.resetTo(chunkHeader._totalMessageLength);
+    item._responseLength = chunkHeader._totalMessageLength;
+    item._responseChunks = chunkHeader._numberOfChunks;
+  } else {
+    // follow-up chunks carry their index
+    std::size_t index = chunkHeader._numberOfChunks;
+    if(index == 0 || index < item._responsePlaced || item._responsePending.count(index) ||
+       (item._responseChunks && index >= item._responseChunks)){
+      return false;
+    }
+    if(index != item._responsePlaced){
+      item._responsePending.emplace(index, std::vector<uint8_t>(payload, payload + length));
+      item._responseChunk++;
+      return true;
+    }
+  }
+
+  auto place = [&item](uint8_t const* data, std::size_t size){
+    if(item._responsePlacedLength + size > item._responseLength){
+      return false;
+    }
+    std::memcpy(item._responseBuffer.data() + item._responsePlacedLength, data, size);
+    item._responsePlacedLength += size;
+    item._responsePlaced++;
+    return true;
+  };
+  if(!place(payload, length)){
+    return false;
+  }
+  item._responseChunk++;
+  auto& pending = item._responsePending;
+  while(!pending.empty() && pending.begin()->first == item._responsePlaced){
+    if(!place(pending.begin()->second.data(), pending.begin()->second.size())){
+      return false;
+    }
+    pending.erase(pending.begin());
+  }
+  if(!pending.empty() && pending.rbegin()->first >= item._responseChunks){
+    return false; // waiting for a chunk the message does not have
+  }
+  // the chunks must fill the announced message
+  return item._responsePlaced < item._responseChunks || item._responsePlacedLength == item._responseLength;
+}
+
+bool VstConnection::processStreamedChunk(RequestItem& item, ChunkHeader const& chunkHeader, uint8_t const* payload){
+  bool complete = chunkHeader._isSingle;
+  if(chunkHeader._isFirst){
+    item._responseChunks = chunkHeader._numberOfChunks;
+    item._responseChunk = 1;
+  } else {
+    item._responseChunk++;
+    complete = item._responseChunk == item._responseChunks;
+  }
+
+  uint8_t const* body = payload;
+  std::size_t bodyLength = chunkHeader._chunkPayloadLength;
+  if(!item._responseHeaderLength){
+    // only the message header is buffered - it may span chunks. Its size is
+    // known once the head of the slice (at most 9 bytes) is available.
+    item._responseBuffer.append(payload, chunkHeader._chunkPayloadLength);
+    std::size_t available = item._responseBuffer.byteSize();
+    if(available < 9 && !complete){
+      return false;
+    }
+    std::size_t headerLength = VSlice(item._responseBuffer.data()).byteSize();
+    if(available < headerLength){
+      if(!complete){
+        return false;
+      }
+      headerLength = available; // truncated - left to the header validation
+    }
+    item._responseHeaderLength = headerLength;
+    body = item._responseBuffer.data() + headerLength;
+    bodyLength = available - headerLength;
+  }
+
+  if(bodyLength){
+    item._onChunk(item._messageId, body, bodyLength);
+  }
+  if(item._responseBuffer.byteSize() > item._responseHeaderLength){
+    item._responseBuffer.resetTo(item._responseHeaderLength); // keep the header only
+  }
+  if(complete){
+    // the response consists of the message header
+    item._responseLength = item._responseHeaderLength;
+  }
+  return complete;
+}
+
 void VstConnection::processCompleteItem(std::shared_ptr<RequestItem>&& itempointer){
+  if(!takeItem(itempointer->_messageId)){
+    return; // the request has already been completed otherwise
+  }
   RequestItem& item = *itempointer;
+  feedback(item, true);
   FUERTE_LOG_VSTTRACE << "completing item with messageid: " << item._messageId << std::endl;
-  auto itemCursor = item._responseBuffer.data();
-  auto itemLength = item._responseBuffer.byteSize();
+  if(!item._responseData){
+    // the chunks of a multi chunk message have been assembled in _responseBuffer
+    auto buffer = std::make_shared<VBuffer>(std::move(item._responseBuffer));
+    item._responseData = std::shared_ptr<uint8_t const>(buffer, buffer->data());
+  }
+  auto itemCursor = item._responseData.get();
+  std::size_t itemLength = item._responseLength;
   std::size_t messageHeaderLength;
   MessageHeader messageHeader = validateAndExtractMessageHeader(_vstVersionID, itemCursor, itemLength, messageHeaderLength);
-  itemCursor += messageHeaderLength;
   itemLength -= messageHeaderLength;
 
   auto response = std::unique_ptr<Response>(new Response(std::move(messageHeader)));
   response->messageid = itempointer->_messageId;
   // finally add payload
 
-  // avoiding the copy would imply that we mess with offsets
-  // if feels like Velocypack could gain some options like
-  // adding some offset for a buffer that way the already
-  // allocated memory could be reused.
-  if(messageHeader.contentType() == ContentType::VPack){
-    auto numPayloads = vst::validateAndCount(itemCursor,itemLength);
+  // the response shares the item's data and points past the
+  // message header, so the payload is not copied again
+  std::shared_ptr<uint8_t const> payload(std::move(item._responseData), itemCursor + messageHeaderLength);
+  if(!itemLength){
+    // no payload (e.g. the body has been streamed)
+  } else if(response->contentType() == ContentType::VPack){
+    auto numPayloads = vst::validateAndCount(payload.get(),itemLength);
     FUERTE_LOG_VSTTRACE << "number of slices: " << numPayloads << std::endl;
-    VBuffer buffer;
-    buffer.append(itemCursor,itemLength); //we should avoid this copy FIXME
-    buffer.resetTo(itemLength);
-    auto slice = VSlice(itemCursor);
+    auto slice = VSlice(payload.get());
     FUERTE_LOG_VSTTRACE << to_string(slice)  << " , " << slice.byteSize() << std::endl;
-    FUERTE_LOG_VSTTRACE << "buffer size" << " , " << buffer.size() << std::endl;
-    response->addVPack(std::move(buffer)); //ASK jan
+    response->addVPack(std::move(payload),itemLength);
     FUERTE_LOG_VSTTRACE << "payload size" << " , " << response->payload().second << std::endl;
   } else {
-    response->addBinary(itemCursor,itemLength);
+    response->addBinarySingle(std::move(payload),itemLength);
   }
   // call callback
   item._onSuccess(std::move(item._request),std::move(response));
-  {
-    Lock mapLock(_mapMutex);
-    _messageMap.erase(item._messageId);
-  }
 }
 
 void VstConnection::handleRead(const boost::system::error_code& error, std::size_t transferred){
   if (error){
     FUERTE_LOG_CALLBACKS << "Error while reading form socket";
     FUERTE_LOG_ERROR << error.message() << std::endl;
+    _reading = false; // the new connection starts its own read loop
     restartConnection();
+    return;
   }
 
   FUERTE_LOG_CALLBACKS << "R(" << transferred << ")" ;
@@ -481,19 +1107,16 @@ void VstConnection::handleRead(const boost::system::error_code& error, std::size
   // throw std::logic_error("handler called without receiving data");
   //}
 
-  boost::asio::const_buffer received = _receiveBuffer.data(); //no copy
-  std::size_t size = boost::asio::buffer_size(received);
-
-  //assert(transferred == size); // could be longer because we do not take everything form the buffer
-  auto pair = bufferToPointerAndSize<uint8_t>(received); //get write access
-  if (!vst::isChunkComplete(pair.first, pair.second)){
+  _receiveEnd += transferred;
+  adaptReceiveSlab(transferred);
+  uint8_t const* cursor = _receiveBuffer->data() + _receiveBegin;
+  std::size_t length = _receiveEnd - _receiveBegin;
+  if (!vst::isChunkComplete(cursor, length)){
     FUERTE_LOG_CALLBACKS << "no complete chunk continue reading" << std::endl;
     startRead();
     return;
   }
 
-  uint8_t const* cursor = pair.first;
-  auto length = pair.second;
   std::size_t consumed = 0;
   std::vector<std::shared_ptr<RequestItem>> items;
 
@@ -513,7 +1136,7 @@ void VstConnection::handleRead(const boost::system::error_code& error, std::size
       }
     }
 
-    _receiveBuffer.consume(consumed); //remove chunk from input
+    _receiveBegin += consumed; //remove chunk from input
   }
 
   /// end new function
@@ -533,85 +1156,215 @@ void VstConnection::handleRead(const boost::system::error_code& error, std::size
   //}
 }
 
-void VstConnection::startWrite(bool possiblyEmpty){
+void VstConnection::startWrite(){
+  // only one writer at a time - the caller holds _writeScheduled
   FUERTE_LOG_TRACE << "+" ;
   if (_pleaseStop) {
-    return;
+    _writeScheduled = false;
+    // the connection may have been established after the check - the
+    // new connection either sees the flag released or we continue
+    if(_pleaseStop || _writeScheduled.exchange(true)){
+      return;
+    }
   }
 
-  std::shared_ptr<RequestItem> next;
-  {
-    Lock sendQueueLock(_sendQueueMutex);
-    if(_sendQueue.empty()){
-      assert(possiblyEmpty);
-      return;
+  if(_generation != _writeGeneration){
+    // new connection - requests are sent from their first chunk again and
+    // replayed requests go first as they have been sent before all others.
+    // Only the authentication message is sent before them.
+    uint64_t generation;
+    std::vector<RequestItemSP> replay;
+    RequestItemSP authentication;
+    {
+      Lock lock(_replayMutex);
+      generation = _generation;
+      replay.swap(_replayQueue);
+      authentication = std::move(_authentication);
+    }
+    std::sort(replay.begin(), replay.end(), [](RequestItemSP const& a, RequestItemSP const& b){
+      return a->_messageId < b->_messageId;
+    });
+    for(auto& item : _writeQueue){
+      item->_requestBufferOffset = 0;
+    }
+    for(auto it = replay.rbegin(); it != replay.rend(); ++it){
+      (*it)->_requestBufferOffset = 0;
+      _writeQueue.push_front(std::move(*it));
     }
-    next = _sendQueue.front();
+    if(authentication){
+      _writeQueue.push_front(std::move(authentication));
+    }
+    _writeGeneration = generation;
+    _writePreamble = true;
   }
 
-  {
-    Lock mapLock(_mapMutex);
-    _messageMap.emplace(next->_messageId,next);
+  auto batch = std::make_shared<WriteBatch>();
+  std::vector<ba::const_buffer> buffers;
+  std::size_t batchBytes = 0;
+  while(batch->empty()){
+    // adopt new requests - the writer is the single consumer of _sendQueue
+    RequestItemSP* queued;
+    while(true){
+      while(_sendQueue.pop(queued)){
+        _writeQueue.push_back(std::move(*queued));
+        delete queued;
+      }
+      if(!_writeQueue.empty()){
+        break;
+      }
+      _writeScheduled = false;
+      // a request may have been pushed after the last pop by a producer that
+      // found the flag still set - take over again if nobody else did
+      if(_sendQueue.empty() || _writeScheduled.exchange(true)){
+        return;
+      }
+    }
+
+    // collect chunks of the queued items round-robin into a single vectored
+    // write. The items taken form a prefix of _writeQueue.
+    bool progress = true;
+    while(progress && batchBytes < maxWriteBatchSize){
+      progress = false;
+      std::size_t i = 0;
+      while(i < _writeQueue.size() && batchBytes < maxWriteBatchSize){
+        if(i == batch->size()){
+          auto const& next = _writeQueue[i];
+          if(next->_requestBufferOffset == 0 && !_messageStore.find(next->_messageId)){
+            // completed before it has been written (e.g. timeout)
+            _writeQueue.erase(_writeQueue.begin() + i);
+            continue;
+          }
+          batch->emplace_back(next, next->_requestBufferOffset);
+        }
+        auto& entry = (*batch)[i++];
+        assert(entry.first->_requestBuffer);
+        VBuffer const& data = *entry.first->_requestBuffer;
+        if(entry.second == data.byteSize()){
+          continue; //all chunks of this item are part of the batch
+        }
+        uint8_t const* chunk = data.data() + entry.second;
+        auto vstChunkHeader = vst::readChunkHeader(_vstVersionID, chunk);
+        buffers.emplace_back(chunk, vstChunkHeader._chunkLength);
+        entry.second += vstChunkHeader._chunkLength;
+        batchBytes += vstChunkHeader._chunkLength;
+        progress = true;
+      }
+    }
   }
 
   FUERTE_LOG_CALLBACKS << "s";
 
-  // make sure we are connected and handshake has been done
-  auto self = shared_from_this();
-  assert(next);
-  assert(next->_requestBuffer);
-  VBuffer const& data = *next->_requestBuffer;
+  if(_writePreamble){
+    // the protocol version precedes the first chunk of a connection
+    auto const& preamble = vst::preamble(_vstVersionID);
+    buffers.insert(buffers.begin(), ba::buffer(preamble.data(), preamble.size()));
+  }
+
 #ifdef FUERTE_CHECKED_MODE
-  FUERTE_LOG_VSTTRACE << "Checking outgoing data for message: " << next->_messageId << std::endl;
-  auto vstChunkHeader = vst::readChunkHeaderV1_0(data.data());
-  validateAndCount(data.data() + vstChunkHeader._chunkHeaderLength
-                  ,data.byteSize() - vstChunkHeader._chunkHeaderLength);
+  for(auto const& entry : *batch){
+    auto const& next = entry.first;
+    if(next->_requestBufferOffset != 0){
+      continue;
+    }
+    FUERTE_LOG_VSTTRACE << "Checking outgoing data for message: " << next->_messageId << std::endl;
+    uint8_t const* chunk = next->_requestBuffer->data();
+    auto vstChunkHeader = vst::readChunkHeader(_vstVersionID, chunk);
+    if(vstChunkHeader._isSingle){ // multi chunk messages have headers in between
+      validateAndCount(chunk + vstChunkHeader._chunkHeaderLength
+                      ,vstChunkHeader._chunkPayloadLength);
+    }
+  }
 #endif
-  FUERTE_LOG_CALLBACKS << data.byteSize();
-  ba::async_write(*_socket
-                 ,ba::buffer(data.data(),data.byteSize())
-                 ,[this,self,next](BoostEC const& error, std::size_t transferred){
-                    this->handleWrite(error,transferred, next);
-                  }
-                 );
+
+  // make sure we are connected and handshake has been done
+  auto socket = std::atomic_load(&_socket);
+  auto sslSocket = std::atomic_load(&_sslSocket);
+  if(!socket || _pleaseStop || _writeGeneration != _generation){
+    // reset after the check - nothing of the batch has been sent, the
+    // items are still at the front of _writeQueue
+    startWrite();
+    return;
+  }
+  auto self = shared_from_this();
+  FUERTE_LOG_CALLBACKS << batchBytes;
+  auto handler = [this,self,batch,socket,sslSocket](BoostEC const& error, std::size_t transferred){
+    this->handleWrite(error,transferred, batch);
+  };
+  if(_configuration._ssl){
+    _strand.dispatch([this,sslSocket,buffers,handler](){
+      ba::async_write(*sslSocket, buffers, _strand.wrap(handler));
+    });
+  } else {
+    ba::async_write(*socket, buffers, handler);
+  }
 }
 
-void VstConnection::handleWrite(BoostEC const& error, std::size_t transferred, RequestItemSP item){
+void VstConnection::handleWrite(BoostEC const& error, std::size_t, std::shared_ptr<WriteBatch> batch){
   FUERTE_LOG_CALLBACKS << "S";
 
-  if (error){
-    FUERTE_LOG_ERROR << error.message() << std::endl;
-    _pleaseStop = true; //stop reading as well
-    {
-      Lock lock(_mapMutex);
-      _messageMap.erase(item->_messageId);
+  // Requests that may have reached the server are marked as written before
+  // the generation is checked, so a reset never sends them again unless they
+  // are idempotent. After a failed write any request of the batch may have
+  // been sent. If the connection has been reset already, restartConnection()
+  // has not seen these requests and they are replayed or failed here.
+  bool stale = false;
+  std::size_t unfinished = 0;
+  std::vector<RequestItemSP> failed;
+  {
+    Lock lock(_replayMutex);
+    stale = _writeGeneration != _generation;
+    for(auto& entry : *batch){
+      auto& item = *entry.first;
+      bool sent = entry.second > item._requestBufferOffset;
+      if(!error){
+        item._requestBufferOffset = entry.second;
+        sent = entry.second == item._requestBuffer->byteSize();
+      }
+      if(!sent){
+        // chunks left - requeue behind the other pending messages
+        (*batch)[unfinished++] = std::move(entry);
+      } else if(!stale){
+        item._written = true;
+        if(!error && !item._idempotent){
+          item._requestBuffer.reset(); //request is written we no longer need the buffer
+        }
+      } else if(item.replayable()){
+        item.resetResponse();
+        _replayQueue.push_back(entry.first);
+      } else if(takeItem(item._messageId)){
+        failed.push_back(entry.first);
+      }
     }
+  }
+  for(auto& item : failed){
+    item->_onError(errorToInt(ErrorCondition::VstCanceldDuringReset)
+                  ,std::move(item->_request)
+                  ,nullptr);
+  }
 
-    //let user know that this request caused the error
-    item->_onError(errorToInt(ErrorCondition::VstWriteError),std::move(item->_request),nullptr);
-
-    restartConnection();
-
-    // pop at the very end of error handling so nothing else
-    // gets queued in the io_service
-    Lock sendQueueLock(_sendQueueMutex);
-    _sendQueue.pop_front();
+  // the batch is a prefix of _writeQueue - sent requests leave the queue,
+  // the reset decides about them
+  _writeQueue.erase(_writeQueue.begin(), _writeQueue.begin() + batch->size());
+  if(error || stale){
+    // unfinished requests are sent from their first chunk on the new connection
+    for(std::size_t i = unfinished; i-- > 0;){
+      _writeQueue.push_front(std::move((*batch)[i].first));
+    }
+    if(!stale){
+      FUERTE_LOG_ERROR << error.message() << std::endl;
+      restartConnection();
+    }
+    startWrite();
     return;
   }
-  item->_requestBuffer.reset(); //request is written we no longer need the buffer
+
   //everything is ok
-  // remove item when work is done;
-  // so the queue does not get empty in between which could
-  // trigger another parallel write that is not allowed
-  // the caller of async_write has to make sure that there
-  // are no parallel calls
-  {
-    Lock sendQueueLock(_sendQueueMutex);
-    _sendQueue.pop_front();
-    if(_sendQueue.empty()){ return; }
+  _writePreamble = false;
+  for(std::size_t i = 0; i < unfinished; ++i){
+    _writeQueue.push_back(std::move((*batch)[i].first));
   }
-  //startWrite();
-  auto self = shared_from_this();
-  _ioService->dispatch( [self](){ self->startWrite(); });
+  // we are already running on the io_service - no need to dispatch again
+  // startWrite releases _writeScheduled when there is nothing left to write
+  startWrite();
 }
 }}}}
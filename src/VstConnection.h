@@ -25,18 +25,25 @@
 #define ARANGO_CXX_DRIVER_VST_CONNECTION_H 1
 
 #include <atomic>
+#include <condition_variable>
 #include <mutex>
-#include <map>
 #include <deque>
+#include <vector>
 
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/ssl.hpp>
-#include <boost/asio/streambuf.hpp>
 #include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/lockfree/queue.hpp>
 
 #include <fuerte/connection_interface.h>
 #include <fuerte/vst.h>
 
+#include "ConcurrencyLimiter.h"
+#include "MessageStore.h"
+#include "TimerWheel.h"
+
 // naming in this file will be closer to asio for internal functions and types
 // functions that are exposed to other classes follow ArangoDB conding conventions
 
@@ -57,18 +64,38 @@ class VstConnection : public std::enable_shared_from_this<VstConnection>, public
 // first write.
 //
 // The startRead function uses the function handleRead as handler for the
-// async_read on the socket. This handler calls start Read as soon it has taken
+// async_read_some on the socket. This handler calls start Read as soon it has taken
 // all relevant data from the socket. so The loop runs until the vstConnection
 // is stopped.
 //
 // startWrite will be Triggered after establishing a connection or when new
 // data has been queued for sending. Then startWrite and handleWrite call each
 // other in the same way as startRead / handleRead but stop doing so as soon as
-// the writeQueue is empty.
+// the writeQueue is empty. sendRequest pushes to a lock-free queue and only
+// schedules startWrite if it manages to set _writeScheduled, so there is never
+// more than one writer.
+//
+// Every write takes chunks of the queued items round-robin until
+// maxWriteBatchSize bytes are collected and sends them with a single vectored
+// async_write. Items that still have chunks left are moved to the back of the
+// queue, so small requests are not stuck behind large ones.
 //
 
 public:
+  // items taken by a single write and the offsets of their
+  // request buffers once the write has completed
+  using WriteBatch = std::vector<std::pair<std::shared_ptr<RequestItem>,std::size_t>>;
+
+  // number of bytes collected for a single async_write (a batch always
+  // contains at least one chunk)
+  static constexpr std::size_t maxWriteBatchSize = 256 * 1024;
+
+  // smallest receive buffer allocated for reads that return little data
+  // (bounded by the configured receive buffer size)
+  static constexpr std::size_t minReceiveSlabSize = 4 * 1024;
+
   explicit VstConnection(detail::ConnectionConfiguration const&);
+  ~VstConnection();
 
 public:
   // this function prepares the request for sending
@@ -86,12 +113,20 @@ public:
   // asynchronous operation and a condition variable
   std::unique_ptr<Response> sendRequest(std::unique_ptr<Request>) override;
 
+  // removes the request from the store - a queued request is skipped by the
+  // writer, chunks of a response that arrive later are dropped
+  void cancel(MessageID) override;
+
 private:
   // SOCKET HANDLING /////////////////////////////////////////////////////////
   void initSocket();
   void shutdownSocket();
-  void shutdownConnection();
+  // closes the socket after a read or write error and connects again
+  // requests survive unless they have been written and are not idempotent
   void restartConnection();
+  // closes the socket and fails all requests - the next request connects
+  // again
+  void closeConnection(ErrorCondition);
 
   virtual void start() override { initSocket(); }
   virtual void restart() override { initSocket(); }
@@ -100,30 +135,74 @@ private:
   //handler to be posted to loop
   //this handler call their handle counterpart on completion
 
-  // establishes connection and initiates handshake
-  void startConnect(boost::asio::ip::tcp::resolver::iterator);
-  void handleConnect(boost::system::error_code const& ec, boost::asio::ip::tcp::resolver::iterator);
+  // resolves the current host asynchronously - moves on to the next
+  // host on failure and fails all requests when no host is left
+  void startResolve();
+  void handleResolve(boost::system::error_code const& ec, boost::asio::ip::tcp::resolver::iterator);
+  // establishes connection to the current endpoint and initiates handshake
+  // every attempt is limited by the connect timeout
+  void startConnect();
+  void handleConnect(boost::system::error_code const& ec);
+  // completes all queued and in-flight requests with the given error
+  void failAllRequests(ErrorCondition);
 
   // does handshake and starts async read and write
   void startHandshake();
+  // openssl callback for new tls sessions of the connection's context
+  static int newSslSession(SSL*, SSL_SESSION*);
+  // slot of the connection in the ex data of its ssl context
+  static int sslContextIndex();
 
   void finishInitialization();
+  // creates the authentication message of a new connection (if a user is
+  // configured) and makes the writer start over on the new connection
+  void queueAuthentication();
 
-  // reads data from socket with boost::asio::async_read
+  // reads as much data as available from socket with async_read_some
   void startRead();
-  // handler for boost::asio::async_read that extracs chunks form the network
+  // handler for async_read_some that extracs chunks form the network
   // takes complete chunks form the socket and starts a new read action. After
   // triggering the next read it processes the received data.
   void handleRead(boost::system::error_code const&, std::size_t transferred);
   // processes single chunks and updates cursor to the next position
   // returns bool signaling if more chunks need to be processed and MessageID of the just processed chunk
   std::tuple<bool,std::shared_ptr<RequestItem>,std::size_t> processChunk(uint8_t const* cursor, std::size_t length);
+  bool placeChunk(RequestItem&, ChunkHeader const&, uint8_t const* payload);
+  // passes the body part of a chunk of a streamed response to the chunk
+  // callback - returns true if the message is complete
+  bool processStreamedChunk(RequestItem&, ChunkHeader const&, uint8_t const* payload);
   void processCompleteItem(std::shared_ptr<RequestItem>&& item);
+  // makes sure there is free space at the end of the receive buffer and
+  // room for the complete next chunk if its length is already known -
+  // returns false if the chunk exceeds the maximal message size
+  bool prepareReceiveBuffer();
+  // sizes the next receive buffer after the amount of data of a read
+  void adaptReceiveSlab(std::size_t transferred);
+
+  // counts a new request against the limits of the connection - returns
+  // false if it has to be rejected, blocks with BackpressurePolicy::Block
+  bool admit(RequestItem&);
+  // releases the capacity of a completed request
+  void release(RequestItem const&);
+  // true if a request of the given length fits into the limits - called
+  // with _capacityMutex held
+  bool hasCapacity(std::size_t requestLength) const;
+  // passes the outcome of a request to the adaptive limiter
+  void feedback(RequestItem const&, bool success);
+
+  // removes a request from the store and its timeout - returns nullptr if
+  // the request has already been completed
+  std::shared_ptr<RequestItem> takeItem(MessageID);
+  void addTimeout(RequestItem&, std::chrono::milliseconds);
+  void startTimeoutTimer(TimerWheel::Clock::time_point);
+  // fails all requests whose timeout has expired
+  void handleTimeout();
 
   // writes data form task queue to network using boost::asio::async_write
-  void startWrite(bool possiblyEmpty = false);
+  // must only be called by the thread that has set _writeScheduled
+  void startWrite();
   // handler for boost::asio::async_wirte that calls startWrite as long as there is new data
-  void handleWrite(boost::system::error_code const&, std::size_t transferred, std::shared_ptr<RequestItem>);
+  void handleWrite(boost::system::error_code const&, std::size_t transferred, std::shared_ptr<WriteBatch>);
 
 private:
   // TODO FIXME -- fix alignment when done so mutexes are not on the same cacheline etc
@@ -132,22 +211,74 @@ private:
   ::std::atomic_uint_least64_t _messageId;
   // socket
   ::boost::asio::io_service* _ioService;
-  ::std::shared_ptr<::boost::asio::ip::tcp::socket> _socket;
+  // sockets - replaced on reconnect while the reader and the writer use
+  // them, accessed with atomic_load/atomic_store only
+  using SocketSP = ::std::shared_ptr<::boost::asio::ip::tcp::socket>;
+  using SslSocketSP = ::std::shared_ptr<::boost::asio::ssl::stream<::boost::asio::ip::tcp::socket&>>;
+  SocketSP _socket;
   ::boost::asio::ssl::context _context;
-  ::std::shared_ptr<::boost::asio::ssl::stream<::boost::asio::ip::tcp::socket&>> _sslSocket;
-  ::boost::asio::ip::tcp::resolver::iterator _endpoints;
-  ::boost::asio::ip::tcp::endpoint _peer;
-  ::boost::asio::deadline_timer _deadline;
+  SslSocketSP _sslSocket;
+  ::std::shared_ptr<SSL_SESSION> _sslSession; // of the last tls connection - resumed on reconnect
+  ::std::size_t _sslSessionHost; // index of the host the session belongs to
+  ::boost::asio::io_service::strand _strand; // serializes operations on the tls stream
+  // endpoints - the configured hosts are tried in order
+  ::boost::asio::ip::tcp::resolver _resolver;
+  ::std::vector<::std::pair<::std::string,::std::string>> _hosts;
+  ::std::size_t _hostIndex;
+  ::std::vector<::boost::asio::ip::tcp::endpoint> _endpointList; // of current host
+  ::std::size_t _endpointIndex;
+  ::std::atomic_uint_least64_t _connectAttempt;
+  ::boost::asio::deadline_timer _deadline; // connect timeout
+  ::boost::asio::steady_timer _reconnectTimer; // backoff between rounds over all hosts
+  unsigned _reconnectAttempt;
+  ::std::atomic_bool _connectFailed; // no host reachable - the next request connects again
+  // incremented on every reset - handlers of the old socket are ignored
+  ::std::atomic_uint_least64_t _generation;
+  uint64_t _writeGeneration; // connection the writer is sending on
+  bool _writePreamble; // the writer has not sent the preamble on this connection
   // reset
   ::std::atomic_bool _connected;
   ::std::atomic_bool _pleaseStop;
-  ::std::atomic_bool _reading;
+  ::std::atomic_bool _reading; // owned by the read loop - released by the reader only
   //queues
-  ::boost::asio::streambuf _receiveBuffer; // async read can not run concurrent
-  ::std::mutex _sendQueueMutex;
-  ::std::deque<std::shared_ptr<RequestItem>> _sendQueue;
-  ::std::mutex _mapMutex;
-  ::std::map<MessageID,std::shared_ptr<RequestItem>> _messageMap;
+  // async read can not run concurrent. Data between _receiveBegin and
+  // _receiveEnd has not been processed yet. Responses of single chunk
+  // messages keep a reference to the buffer instead of copying their
+  // payload. A referenced buffer is not written again - reads continue in
+  // a new one of _receiveSlabSize bytes. The size follows the amount of data
+  // the reads return, so small responses only keep a small buffer alive.
+  ::std::shared_ptr<::std::vector<uint8_t>> _receiveBuffer;
+  ::std::size_t _receiveSlabSize;
+  ::std::size_t _receiveOffered; // free space handed to the pending read
+  uint64_t _readGeneration; // connection the receive buffer belongs to
+  ::std::size_t _receiveBegin;
+  ::std::size_t _receiveEnd;
+  ::std::atomic_bool _writeScheduled; // set while a writer is active
+  // requests queued by sendRequest - the writer is the only consumer
+  ::boost::lockfree::queue<std::shared_ptr<RequestItem>*> _sendQueue;
+  // requests adopted by the writer that still have chunks to send
+  ::std::deque<std::shared_ptr<RequestItem>> _writeQueue;
+  // written idempotent requests to be sent again after a reset - the
+  // mutex also guards RequestItem::_written and the generation change
+  ::std::mutex _replayMutex;
+  ::std::vector<std::shared_ptr<RequestItem>> _replayQueue;
+  // authentication message of the current connection - handed to the writer
+  // once, the id is kept to drop the message when the connection is reset
+  ::std::shared_ptr<RequestItem> _authentication;
+  MessageID _authenticationId;
+  MessageStore<RequestItem> _messageStore; // requests that are not completed
+  // admitted requests that are not completed
+  ::std::mutex _capacityMutex;
+  ::std::condition_variable _capacityCondition;
+  ::std::size_t _inFlightRequests;
+  ::std::size_t _inFlightBytes;
+  bool _notifyReady; // a request has been rejected with BackpressurePolicy::Notify
+  ::std::unique_ptr<ConcurrencyLimiter> _limiter; // only with adaptive limits
+  // timeouts of the requests in _messageStore
+  ::std::mutex _timeoutMutex;
+  TimerWheel _timeouts;
+  ::boost::asio::steady_timer _timeoutTimer;
+  bool _timeoutTimerArmed;
   int _vstVersionID;
 };
 
@@ -22,6 +22,7 @@
 
 #include <fuerte/connection.h>
 #include <fuerte/database.h>
+#include "AsioHttpConnection.h"
 #include "HttpConnection.h"
 #include "VstConnection.h"
 
@@ -39,6 +40,9 @@ namespace arangodb { namespace fuerte { inline namespace v1 {
         FUERTE_LOG_DEBUG << "fuerte - creating velocystream connection" << std::endl;
         _realConnection = std::make_shared<vst::VstConnection>(_configuration);
         _realConnection->start();
+      } else if (_configuration._httpBackend == HttpBackend::Asio){
+        FUERTE_LOG_DEBUG << "fuerte - creating asio http connection" << std::endl;
+        _realConnection = std::make_shared<http::AsioHttpConnection>(_configuration);
       } else {
         //throw std::logic_error("http in vst test");
         FUERTE_LOG_DEBUG << "fuerte - creating http connection" << std::endl;
@@ -46,37 +50,108 @@ namespace arangodb { namespace fuerte { inline namespace v1 {
       }
     };
 
-  ConnectionBuilder& ConnectionBuilder::host(std::string const& str){
+  constexpr unsigned ConnectionPool::connectionIdShift;
+
+  ConnectionPool::ConnectionPool(detail::ConnectionConfiguration const& conf, std::size_t size)
+    : _start(0)
+    {
+      if (conf._connType != TransportType::Vst){
+        throw std::logic_error("connection pools are only supported for velocystream");
+      }
+      if (size == 0 || size > (std::size_t(1) << (64 - connectionIdShift))){
+        throw std::invalid_argument("invalid connection pool size");
+      }
+      _connections.reserve(size);
+      for(std::size_t i = 0; i < size; ++i){
+        auto connectionConf = conf;
+        connectionConf._messageIdBase = static_cast<uint64_t>(i) << connectionIdShift;
+        _connections.emplace_back(new Connection(connectionConf));
+      }
+    }
+
+  std::shared_ptr<Connection> const& ConnectionPool::next(){
+    std::size_t size = _connections.size();
+    std::size_t start = _start++ % size;
+    std::size_t best = start;
+    std::size_t bestLeft = _connections[start]->requestsLeft();
+    for(std::size_t i = 1; i < size && bestLeft; ++i){
+      std::size_t candidate = (start + i) % size;
+      std::size_t left = _connections[candidate]->requestsLeft();
+      if(left < bestLeft){
+        best = candidate;
+        bestLeft = left;
+      }
+    }
+    return _connections[best];
+  }
+
+  std::size_t ConnectionPool::requestsLeft(){
+    std::size_t left = 0;
+    for(auto& connection : _connections){
+      left += connection->requestsLeft();
+    }
+    return left;
+  }
+
+  void ConnectionPool::cancel(MessageID id){
+    std::size_t index = static_cast<std::size_t>(id >> connectionIdShift);
+    if(index < _connections.size()){
+      _connections[index]->cancel(id);
+    }
+  }
+
+  // parses (http|vst)[s]://(ip|hostname):port
+  static void parseUrl(std::string const& str, TransportType& type, bool& ssl
+                      ,std::string& host, std::string& port){
     std::vector<std::string> strings;
     boost::split(strings, str, boost::is_any_of(":"));
 
     //get protocol
     std::string const& proto = strings[0];
     if (proto == "vst"){
-      _conf._connType = TransportType::Vst;
-      _conf._ssl = false;
+      type = TransportType::Vst;
+      ssl = false;
     }
     else if (proto == "vsts"){
-      _conf._connType = TransportType::Vst;
-      _conf._ssl = true;
+      type = TransportType::Vst;
+      ssl = true;
     }
     else if (proto == "http"){
-      _conf._connType = TransportType::Http;
-      _conf._ssl = false;
+      type = TransportType::Http;
+      ssl = false;
     }
     else if (proto == "https"){
-      _conf._connType = TransportType::Http;
-      _conf._ssl = true;
+      type = TransportType::Http;
+      ssl = true;
     }
     else {
       throw std::runtime_error(std::string("invalid protocol: ") + proto);
     }
 
+    if (strings.size() != 3){
+      throw std::runtime_error(std::string("invalid url: ") + str);
+    }
+
     //TODO
     //do more checking?
-    _conf._host = strings[1].erase(0,2); //remove '//'
-    _conf._port = strings[2];
+    host = strings[1].erase(0,2); //remove '//'
+    port = strings[2];
+  }
+
+  ConnectionBuilder& ConnectionBuilder::host(std::string const& str){
+    parseUrl(str, _conf._connType, _conf._ssl, _conf._host, _conf._port);
+    return *this;
+  }
 
+  ConnectionBuilder& ConnectionBuilder::addHost(std::string const& str){
+    TransportType type;
+    bool ssl;
+    std::string host, port;
+    parseUrl(str, type, ssl, host, port);
+    if (type != _conf._connType || ssl != _conf._ssl){
+      throw std::logic_error("failover hosts must use the protocol of the primary host");
+    }
+    _conf._failoverHosts.emplace_back(std::move(host), std::move(port));
     return *this;
   }
 
@@ -130,7 +130,7 @@ boost::asio::io_service* Loop::getIoService(){
 
 LoopProvider::LoopProvider()
   :_asioLoop(new Loop{})
-  ,_httpLoop(new http::HttpCommunicator())
+  ,_httpLoop(new http::HttpCommunicator(_asioLoop))
   {}
 
 void LoopProvider::setAsioService(::boost::asio::io_service* service, bool running){
@@ -146,36 +146,17 @@ std::shared_ptr<Loop> LoopProvider::getAsioLoop(){
   return _asioLoop;
 }
 
+// http requests are driven by the asio loop as well
 void LoopProvider::run(){
-  static std::mutex mutex;
-
   if(_asioLoop){
     _asioLoop->run_ready();  //runs unitl all work is done
   }
-
-  //poll http -- spins busy for http
-  if(_httpLoop && _httpLoop->used() && mutex.try_lock()){
-    while (true) {
-      int left = _httpLoop->workOnce(); // check if there is still somehting to do
-      if (left == 0) { break; }
-      _httpLoop->wait(); // work happens here
-    }
-    mutex.unlock();
-  }
 }
 
 void LoopProvider::poll(){
-  static std::mutex mutex;
-  //poll asio
   if(_asioLoop){
     _asioLoop->poll();  //polls until io_service has no further tasks
   }
-
-  //poll http
-  if(_httpLoop && mutex.try_lock()){
-    int left = _httpLoop->workOnce();
-    mutex.unlock();
-  }
 }
 
 void LoopProvider::resetIoService(){
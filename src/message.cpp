@@ -24,6 +24,7 @@
 #include <fuerte/vst.h>
 #include <velocypack/Validator.h>
 #include <sstream>
+#include <tuple>
 
 #ifdef FUERTE_CHECKED_MODE
   #include <fuerte/vst.h>
@@ -259,14 +260,40 @@ void Message::addBinarySingle(VBuffer&& buffer){
   _payload.resetTo(_payloadLength);
 }
 
+void Message::addVPack(std::shared_ptr<uint8_t const> data, std::size_t length){
+#ifdef FUERTE_CHECKED_MODE
+  //FUERTE_LOG_ERROR << "Checking data that is added to the message: " << std::endl;
+  vst::validateAndCount(data.get(),length);
+#endif
+  if(_sealed || _isVpack){
+    throw std::logic_error("Message is sealed or of wrong type (vst/binary)");
+  };
+  contentType(ContentType::VPack);
+  _isVpack = true;
+  _sealed = true;
+  _modified = true;
+  _payloadLength = length;
+  _sharedPayload = std::move(data);
+}
+
+void Message::addBinarySingle(std::shared_ptr<uint8_t const> data, std::size_t length){
+  if(_sealed || (_isVpack && _isVpack.get())){ return; };
+  _isVpack = false;
+  _sealed = true;
+  _modified = true;
+  _payloadLength = length;
+  _sharedPayload = std::move(data);
+}
+
 
 //// get payload
 // get payload as slices
 std::vector<VSlice>const & Message::slices() {
   if(_isVpack && _modified){
     _slices.clear();
-    auto length = _payload.byteSize();
-    auto cursor = _payload.data();
+    std::size_t length;
+    uint8_t const* cursor;
+    std::tie(cursor,length) = payload();
     while(length){
       _slices.emplace_back(cursor);
       auto sliceSize = _slices.back().byteSize();
@@ -284,6 +311,9 @@ std::vector<VSlice>const & Message::slices() {
 // get payload as binary
 std::pair<uint8_t const *, std::size_t> Message::payload() const {
   //return { _payload.data(), _payload.byteSize() };
+  if(_sharedPayload){
+    return { _sharedPayload.get(), _payloadLength };
+  }
   return { _payload.data(), _payloadLength };
 }
 
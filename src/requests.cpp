@@ -104,4 +104,16 @@ createRequest(RestVerb verb
   return request;
 }
 
+std::unique_ptr<Request>
+createAuthenticationRequest(std::string const& user
+                           ,std::string const& password
+                           )
+{
+  auto request = std::unique_ptr<Request>(new Request());
+  request->header.type = MessageType::Authentication;
+  request->header.user = user;
+  request->header.password = password;
+  return request;
+}
+
 }}}
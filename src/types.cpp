@@ -216,9 +216,12 @@ ErrorCondition intToError(Error integral){
       1000, // ConnectionError
       1001, // CouldNotConnect
       1002, // TimeOut
+      1003, // Canceled
+      1004, // QueueFull
       1102, // VstReadError
       1103, // VstWriteError
       1104, // VstCancelledDuringReset
+      1105, // VstUnauthorized
       3000, // CurlError
   };
   auto pos = std::find(valid.begin(), valid.end(), integral);
@@ -247,12 +250,18 @@ std::string to_string(ErrorCondition error){
       return "Error: unable to connect";
     case ErrorCondition::Timeout:
       return "Error: timeout";
+    case ErrorCondition::Canceled:
+      return "Error: request canceled";
+    case ErrorCondition::QueueFull:
+      return "Error: too many requests in flight";
     case ErrorCondition::VstReadError:
       return "Error: reading vst";
     case ErrorCondition::VstWriteError:
       return "Error: writing vst";
     case ErrorCondition::VstCanceldDuringReset:
       return "Error: cancel as result of other error";
+    case ErrorCondition::VstUnauthorized:
+      return "Error: vst authentication failed";
 
     case ErrorCondition::CurlError:
       return "Error: in curl";
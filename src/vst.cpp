@@ -89,19 +89,19 @@ static ChunkHeader createSingleChunkHeader(int vstVersionID
 static ChunkHeader createFirstChunkHeader(int vstVersionID
                                          ,MessageID messageID
                                          ,std::size_t chunkPayloadLength
-                                         ,std::size_t totoalMessageLength
+                                         ,std::size_t totalMessageLength
                                          ,std::size_t numberOfChunks){
-  return createChunkHeader(vstVersionID, messageID, chunkPayloadLength
-                          ,totoalMessageLength, numberOfChunks, false);
+  return createChunkHeader(vstVersionID, messageID, totalMessageLength
+                          ,chunkPayloadLength, numberOfChunks, true);
 }
 
 static ChunkHeader createFollowUpChunkHeader(int vstVersionID
                                          ,MessageID messageID
                                          ,std::size_t chunkPayloadLength
                                          ,std::size_t totalMessageLength
-                                         ,std::size_t numberOfChunks){
-  return createChunkHeader(vstVersionID, messageID, chunkPayloadLength
-                          ,totalMessageLength, numberOfChunks, false);
+                                         ,std::size_t chunkNumber){
+  return createChunkHeader(vstVersionID, messageID, totalMessageLength
+                          ,chunkPayloadLength, chunkNumber, false);
 }
 
 
@@ -150,7 +150,8 @@ static void addVstMessageHeader(VBuilder& builder
   //FUERTE_LOG_DEBUG << "MessageHeader.type=" << static_cast<int>(header.type.get()) << std::endl;
   switch (header.type.get()){
     case MessageType::Authentication:
-      //builder.add(VValue(header.encryption.get()));
+      // 2 - encryption - only plain is supported
+      builder.add(VValue("plain"));
       if(!header.user){ throw std::runtime_error("user" + message); }
       builder.add(VValue(header.user.get()));
       //FUERTE_LOG_DEBUG << "MessageHeader.user=" << header.user.get() << std::endl;
@@ -207,80 +208,98 @@ static void addVstMessageHeader(VBuilder& builder
 
 // ################################################################################
 
-std::shared_ptr<VBuffer> toNetwork(Request& request){
-  auto buffer = std::make_shared<VBuffer>();
-  std::size_t const vstVersionID = 1;
+std::string const& preamble(int vstVersionID){
+  static std::string const v1_0("VST/1.0\r\n\r\n");
+  static std::string const v1_1("VST/1.1\r\n\r\n");
+  return vstVersionID == 1 ? v1_0 : v1_1;
+}
 
-  // setting defaults
-  request.header.version = vstVersionID;
+std::shared_ptr<VBuffer> toNetwork(Request& request, std::size_t maxChunkSize, int vstVersionID){
+  // setting defaults - the message header version is 1 for VST 1.0 and 1.1
+  request.header.version = 1;
   if(!request.header.database){
     request.header.database = "_system";
   }
 
-  // add chunk header
-  auto vstChunkHeader = createSingleChunkHeader(vstVersionID, request.messageid, 0); //size is unfortunatly unknown
-  auto chunkHeaderLength = addVstChunkHeader(std::size_t(1), *buffer, vstChunkHeader);
-  FUERTE_LOG_VSTTRACE << "ChunkHeaderLength:"
-                   << chunkHeaderLength << " = " << buffer->byteSize()
-                   << std::endl;
-  VBuilder builder(*buffer);
-
-  // ****** TODO split data into smaller parts so that a **********************
-  //             message can be longer than max chunk len
+  std::size_t const singleChunkHeaderLength = chunkHeaderLength(vstVersionID, true, true);
+  std::size_t const firstChunkHeaderLength = chunkHeaderLength(vstVersionID, true, false);
+  std::size_t const followUpChunkHeaderLength = chunkHeaderLength(vstVersionID, false, false);
+  if(maxChunkSize <= firstChunkHeaderLength){
+    throw std::invalid_argument("maxChunkSize must be larger than " + std::to_string(firstChunkHeaderLength) + " bytes");
+  }
 
   // add message header
+  VBuffer headerBuffer;
+  VBuilder builder(headerBuffer);
   addVstMessageHeader(builder, request.header);
-  auto slice = VSlice(buffer->data()+chunkHeaderLength);
-  auto headerLength = slice.byteSize();
-  buffer->resetTo(chunkHeaderLength+headerLength);
-  FUERTE_LOG_VSTTRACE << "Message Header:\n" << slice.toJson() << " , "
-                                          << chunkHeaderLength << " + " << headerLength
-                                          << " = " << buffer->byteSize()
-                                          << std::endl;
-
-  // add playload (header + data - uncompressed)
-  std::size_t payloadLength = headerLength;
-  {
-    if(request.header.contentType() == ContentType::VPack){
-      for(auto const& slice : request.slices()){
-        payloadLength += slice.byteSize();
-        FUERTE_LOG_VSTTRACE << to_string(slice) << " , " << "adding: " << slice.byteSize() << " bytes to builder" << std::endl;
-        builder.add(slice);
-        buffer->resetTo(chunkHeaderLength+payloadLength);
-      }
-    } else {
-      uint8_t const * data;
-      std::size_t size;
-      std::tie(data,size) = request.payload();
-      payloadLength += size;
-      buffer->append(data,size);
-      buffer->resetTo(chunkHeaderLength+payloadLength);
-    }
+  auto slice = VSlice(headerBuffer.data());
+  std::size_t const headerLength = slice.byteSize();
+  FUERTE_LOG_VSTTRACE << "Message Header:\n" << slice.toJson() << " , " << headerLength << std::endl;
+
+  // payload (header + data - uncompressed)
+  uint8_t const* payload;
+  std::size_t payloadLength;
+  std::tie(payload, payloadLength) = request.payload();
+#ifdef FUERTE_CHECKED_MODE
+  if(request.header.contentType() == ContentType::VPack && payloadLength){
+    validateAndCount(payload, payloadLength);
   }
-
-  // **************************************************************************
-
-  // for the single chunk case chunk len and total message size are the same
-  vstChunkHeader.updateChunkPayload(buffer->data(), payloadLength);
-
-  if ((vstChunkHeader._isFirst && vstChunkHeader._numberOfChunks > 1) || (vstVersionID > 1)) {
-    vstChunkHeader.updateTotalPayload(buffer->data(), payloadLength);
+#endif
+
+  // split the message so that no chunk (including its header) is longer
+  // than maxChunkSize
+  std::size_t const messageLength = headerLength + payloadLength;
+  std::size_t numberOfChunks = 1;
+  if(singleChunkHeaderLength + messageLength > maxChunkSize){
+    std::size_t const firstPayload = maxChunkSize - firstChunkHeaderLength;
+    std::size_t const followUpPayload = maxChunkSize - followUpChunkHeaderLength;
+    numberOfChunks += (messageLength - firstPayload + followUpPayload - 1) / followUpPayload;
   }
+  FUERTE_LOG_VSTTRACE << "message length: " << messageLength
+                      << " chunks: " << numberOfChunks << std::endl;
 
-  //std::cout << "updated header read back in" << std::endl;
-  //auto readheader = readChunkHeaderV1_0(buffer.get()->data());
-  //FUERTE_LOG_DEBUG << chunkHeaderToString(readheader) << std::endl;
-
-  FUERTE_LOG_VSTTRACE << buffer->byteSize() << " = "
-                      << payloadLength << " + "
-                      << chunkHeaderLength
-                      << std::endl;
-  FUERTE_LOG_VSTTRACE << "asserting - buffersize: " << buffer->byteSize()
-                      << " == "
-                      << "chunkLength: "  << vstChunkHeader._chunkLength
-                      << std::endl;
+  auto buffer = std::make_shared<VBuffer>();
+  buffer->reserve(messageLength + firstChunkHeaderLength
+                  + (numberOfChunks - 1) * followUpChunkHeaderLength);
+
+  // the message is the message header followed by the payload, this copies
+  // the part [offset, offset + length) of it into the buffer
+  auto appendMessagePart = [&](std::size_t offset, std::size_t length){
+    if(offset < headerLength){
+      std::size_t const fromHeader = std::min(length, headerLength - offset);
+      buffer->append(headerBuffer.data() + offset, fromHeader);
+      offset += fromHeader;
+      length -= fromHeader;
+    }
+    if(length){
+      buffer->append(payload + (offset - headerLength), length);
+    }
+  };
+
+  std::size_t offset = 0;
+  for(std::size_t chunk = 0; chunk < numberOfChunks; ++chunk){
+    ChunkHeader chunkHeader;
+    if(numberOfChunks == 1){
+      chunkHeader = createSingleChunkHeader(vstVersionID, request.messageid, messageLength);
+    } else if(chunk == 0){
+      chunkHeader = createFirstChunkHeader(vstVersionID, request.messageid
+                                          ,maxChunkSize - firstChunkHeaderLength
+                                          ,messageLength, numberOfChunks);
+    } else {
+      std::size_t const chunkPayloadLength = std::min(messageLength - offset
+                                                     ,maxChunkSize - followUpChunkHeaderLength);
+      chunkHeader = createFollowUpChunkHeader(vstVersionID, request.messageid
+                                             ,chunkPayloadLength, messageLength, chunk);
+    }
+    FUERTE_LOG_VSTTRACE << chunkHeaderToString(chunkHeader);
+    addVstChunkHeader(vstVersionID, *buffer, chunkHeader);
+    appendMessagePart(offset, chunkHeader._chunkPayloadLength);
+    offset += chunkHeader._chunkPayloadLength;
+  }
 
-  assert(buffer->byteSize() == vstChunkHeader._chunkLength);
+  FUERTE_LOG_VSTTRACE << "buffer size: " << buffer->byteSize() << " message length: "
+                      << messageLength << " chunks: " << numberOfChunks << std::endl;
+  assert(offset == messageLength);
   return buffer;
 }
 
@@ -338,6 +357,33 @@ ChunkHeader readChunkHeaderV1_0(uint8_t const * const bufferBegin) {
   return header;
 }
 
+ChunkHeader readChunkHeaderV1_1(uint8_t const * const bufferBegin) {
+  // TODO -- fix endianess
+  ChunkHeader header;
+
+  auto cursor = bufferBegin;
+  std::memcpy(&header._chunkLength, cursor, sizeof(header._chunkLength));
+  cursor += sizeof(header._chunkLength);
+  std::memcpy(&header._chunk, cursor, sizeof(header._chunk));
+  cursor += sizeof(header._chunk);
+  std::memcpy(&header._messageID, cursor, sizeof(header._messageID));
+  cursor += sizeof(header._messageID);
+  std::memcpy(&header._totalMessageLength, cursor, sizeof(header._totalMessageLength));
+  cursor += sizeof(header._totalMessageLength);
+
+  header._isFirst = header._chunk & 0x1;
+  header._numberOfChunks = header._chunk >> 1;
+  header._isSingle = header._isFirst && header._numberOfChunks == 1;
+  header._chunkHeaderLength = std::distance(bufferBegin, cursor);
+  header._chunkPayloadLength = header._chunkLength - header._chunkHeaderLength;
+  return header;
+}
+
+ChunkHeader readChunkHeader(int vstVersionID, uint8_t const * const bufferBegin) {
+  return vstVersionID == 1 ? readChunkHeaderV1_0(bufferBegin)
+                           : readChunkHeaderV1_1(bufferBegin);
+}
+
 MessageHeader messageHeaderFromSlice(int vstVersionID, VSlice const& headerSlice){
   assert(headerSlice.isArray());
   MessageHeader header;
@@ -354,9 +400,9 @@ MessageHeader messageHeaderFromSlice(int vstVersionID, VSlice const& headerSlice
   header.type = static_cast<MessageType>(headerSlice.at(1).getNumber<int>());       //type
   switch (header.type.get()){
     case MessageType::Authentication:
-      //header.encryption = headerSlice.at(6);                                      //encryption (plain) should be 2
-      header.user = headerSlice.at(2).copyString();                                 //user
-      header.password = headerSlice.at(3).copyString();                             //password
+      //header.encryption = headerSlice.at(2);                                      //encryption (plain)
+      header.user = headerSlice.at(3).copyString();                                 //user
+      header.password = headerSlice.at(4).copyString();                             //password
       break;
 
     case MessageType::Request:
@@ -370,10 +416,13 @@ MessageHeader messageHeaderFromSlice(int vstVersionID, VSlice const& headerSlice
     //resoponse should get content type
     case MessageType::Response:
       header.responseCode = headerSlice.at(2).getUInt(); // TODO fix me
-      header.contentType(ContentType::VPack);
       if (headerSlice.length() >= 4) {
         header.meta = sliceToStringMap(headerSlice.at(3));                          // meta
       }
+      // the content type is carried in meta - VPack if it is not set
+      if (header.contentType() == ContentType::Unset) {
+        header.contentType(ContentType::VPack);
+      }
       break;
     default:
       break;
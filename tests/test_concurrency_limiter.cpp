@@ -0,0 +1,102 @@
+////////////////////////////////////////////////////////////////////////////////
+/// DISCLAIMER
+///
+/// Copyright 2016 ArangoDB GmbH, Cologne, Germany
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+///
+/// Copyright holder is ArangoDB GmbH, Cologne, Germany
+///
+/// @author Jan Christoph Uhde
+////////////////////////////////////////////////////////////////////////////////
+#include "test_main.h"
+#include "ConcurrencyLimiter.h"
+
+namespace fu = ::arangodb::fuerte;
+
+// the limit grows by 1/limit per sample - powers of two keep the sums exact
+using ms = std::chrono::milliseconds;
+
+TEST(ConcurrencyLimiter, InitialLimit){
+  ASSERT_EQ(fu::ConcurrencyLimiter(100).limit(), 8u);
+  ASSERT_EQ(fu::ConcurrencyLimiter(4).limit(), 4u);
+  ASSERT_EQ(fu::ConcurrencyLimiter(100, 0).limit(), 1u);
+  // a configured maximum is the initial limit
+  ASSERT_EQ(fu::ConcurrencyLimiter::forMaxInFlight(64).limit(), 64u);
+  ASSERT_EQ(fu::ConcurrencyLimiter::forMaxInFlight(0).limit(), 8u);
+}
+
+TEST(ConcurrencyLimiter, AdditiveIncrease){
+  fu::ConcurrencyLimiter limiter(100, 1);
+  limiter.onSuccess(ms(10));
+  ASSERT_EQ(limiter.limit(), 2u);
+  // one per round of limit() samples
+  limiter.onSuccess(ms(10));
+  ASSERT_EQ(limiter.limit(), 2u);
+  limiter.onSuccess(ms(10));
+  ASSERT_EQ(limiter.limit(), 3u);
+
+  fu::ConcurrencyLimiter four(100, 4);
+  for(int i = 0; i < 3; ++i){
+    four.onSuccess(ms(10));
+  }
+  ASSERT_EQ(four.limit(), 4u);
+  four.onSuccess(ms(10));
+  ASSERT_EQ(four.limit(), 5u);
+}
+
+TEST(ConcurrencyLimiter, MaxLimit){
+  fu::ConcurrencyLimiter limiter(2, 1);
+  for(int i = 0; i < 100; ++i){
+    limiter.onSuccess(ms(10));
+  }
+  ASSERT_EQ(limiter.limit(), 2u);
+}
+
+TEST(ConcurrencyLimiter, MultiplicativeBackoff){
+  fu::ConcurrencyLimiter limiter(100, 16);
+  for(int i = 0; i < 10; ++i){
+    limiter.onSuccess(ms(10));
+  }
+  ASSERT_EQ(limiter.limit(), 16u);
+  // the smoothed latency exceeds twice the baseline
+  limiter.onSuccess(ms(100));
+  ASSERT_EQ(limiter.limit(), 8u);
+}
+
+TEST(ConcurrencyLimiter, WithinTolerance){
+  fu::ConcurrencyLimiter limiter(100, 16);
+  for(int i = 0; i < 10; ++i){
+    limiter.onSuccess(ms(10));
+  }
+  limiter.onSuccess(ms(20));
+  ASSERT_EQ(limiter.limit(), 16u);
+}
+
+TEST(ConcurrencyLimiter, HoldOff){
+  fu::ConcurrencyLimiter limiter(100, 16);
+  limiter.onError();
+  ASSERT_EQ(limiter.limit(), 8u);
+  // the requests sent with the old limit do not cut again
+  for(int i = 0; i < 16; ++i){
+    limiter.onError();
+  }
+  ASSERT_EQ(limiter.limit(), 8u);
+  limiter.onError();
+  ASSERT_EQ(limiter.limit(), 4u);
+
+  for(int i = 0; i < 1000; ++i){
+    limiter.onError();
+  }
+  ASSERT_EQ(limiter.limit(), 1u);
+}
@@ -0,0 +1,533 @@
+////////////////////////////////////////////////////////////////////////////////
+/// DISCLAIMER
+///
+/// Copyright 2016 ArangoDB GmbH, Cologne, Germany
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+///
+/// Copyright holder is ArangoDB GmbH, Cologne, Germany
+///
+/// @author Jan Christoph Uhde
+////////////////////////////////////////////////////////////////////////////////
+#include "test_main.h"
+#include "loopback_server.h"
+
+#include <algorithm>
+
+// runtime behaviour of the http connections against LoopbackHttpServer
+
+// creates a POST request with a binary body of the given length
+static std::unique_ptr<fu::Request> bodyRequest(std::string const& path, std::size_t length){
+  auto request = fu::createRequest(fu::RestVerb::Post, path);
+  std::string body(length, 'a' + length % 26);
+  request->addBinary(reinterpret_cast<uint8_t const*>(body.data()), body.size());
+  return request;
+}
+
+static std::string bodyOf(std::size_t length){
+  return std::string(length, 'a' + length % 26);
+}
+
+TEST(HttpLoopback, CurlRequests){
+  LoopbackHttpServer server;
+  fu::ConnectionBuilder builder;
+  builder.host(server.url());
+  auto connection = builder.connect();
+
+  // curl is driven by the asio loop - requests complete on its threads
+  LoopThreads loop;
+  std::size_t const count = 50;
+  std::atomic<std::size_t> ok(0), failed(0);
+  for(std::size_t i = 0; i < count; ++i){
+    std::unique_ptr<fu::Request> request;
+    std::string expected;
+    if(i % 2){
+      request = fu::createRequest(fu::RestVerb::Get, "/path/" + std::to_string(i));
+      expected = "/path/" + std::to_string(i);
+    } else {
+      request = bodyRequest("/echo", i * 10 + 1);
+      expected = bodyOf(i * 10 + 1);
+    }
+    connection->sendRequest(std::move(request)
+                           ,[&](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+                              ADD_FAILURE() << fu::to_string(fu::intToError(error));
+                              ++failed;
+                            }
+                           ,[&,expected](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response> response){
+                              EXPECT_EQ(response->header.responseCode.get(), 200u);
+                              EXPECT_EQ(response->payloadAsString(), expected);
+                              ++ok;
+                            });
+  }
+  ASSERT_TRUE(waitFor([&]{ return ok + failed == count; }));
+  ASSERT_EQ(ok.load(), count);
+  // a request is left until its callback is called
+  ASSERT_EQ(connection->requestsLeft(), 0u);
+  ASSERT_EQ(server._requests.load(), static_cast<int>(count));
+}
+
+TEST(HttpLoopback, CurlRun){
+  LoopbackHttpServer server;
+  fu::ConnectionBuilder builder;
+  builder.host(server.url());
+  auto connection = builder.connect();
+
+  // run() returns once the requests are completed
+  std::vector<std::string> responses;
+  for(std::string path : {"/a", "/b", "/c"}){
+    connection->sendRequest(fu::createRequest(fu::RestVerb::Get, path)
+                           ,[](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+                              ADD_FAILURE() << fu::to_string(fu::intToError(error));
+                            }
+                           ,[&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response> response){
+                              responses.push_back(response->payloadAsString());
+                            });
+  }
+  fu::run();
+  std::sort(responses.begin(), responses.end());
+  ASSERT_EQ(responses, (std::vector<std::string>{"/a", "/b", "/c"}));
+}
+
+TEST(HttpLoopback, CurlWakeup){
+  LoopbackHttpServer server;
+  fu::ConnectionBuilder builder;
+  builder.host(server.url());
+  auto connection = builder.connect();
+  LoopThreads loop;
+
+  // a request queued while the loop is idle is started right away - not
+  // after curl's next timeout
+  for(int i = 0; i < 5; ++i){
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    std::atomic<bool> done(false);
+    auto start = std::chrono::steady_clock::now();
+    connection->sendRequest(fu::createRequest(fu::RestVerb::Get, "/wakeup")
+                           ,[&](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+                              ADD_FAILURE() << fu::to_string(fu::intToError(error));
+                              done = true;
+                            }
+                           ,[&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){ done = true; });
+    ASSERT_TRUE(waitFor([&]{ return done.load(); }));
+    ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(200));
+  }
+
+  // bursts of several producers are handed over completely
+  std::atomic<int> ok(0);
+  std::vector<std::thread> producers;
+  for(int t = 0; t < 4; ++t){
+    producers.emplace_back([&]{
+      for(int i = 0; i < 50; ++i){
+        connection->sendRequest(fu::createRequest(fu::RestVerb::Get, "/burst")
+                               ,[](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+                                  ADD_FAILURE() << fu::to_string(fu::intToError(error));
+                                }
+                               ,[&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){ ++ok; });
+      }
+    });
+  }
+  for(auto& producer : producers){
+    producer.join();
+  }
+  ASSERT_TRUE(waitFor([&]{ return ok == 200; }));
+}
+
+TEST(HttpLoopback, CurlConnectionReuse){
+  LoopbackHttpServer server;
+  fu::ConnectionBuilder builder;
+  builder.host(server.url());
+  auto connection = builder.connect();
+  LoopThreads loop;
+
+  // sequential requests run on reset handles over the cached connection
+  for(int i = 0; i < 50; ++i){
+    std::atomic<bool> done(false);
+    connection->sendRequest(fu::createRequest(fu::RestVerb::Get, "/reuse")
+                           ,[&](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+                              ADD_FAILURE() << fu::to_string(fu::intToError(error));
+                              done = true;
+                            }
+                           ,[&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response> response){
+                              EXPECT_EQ(response->payloadAsString(), "/reuse");
+                              done = true;
+                            });
+    ASSERT_TRUE(waitFor([&]{ return done.load(); }));
+  }
+  ASSERT_EQ(server._requests.load(), 50);
+  ASSERT_EQ(server._connections.load(), 1);
+}
+
+TEST(HttpLoopback, CurlConnectionLimits){
+  LoopbackHttpServer server;
+  server._delay = 5;
+  fu::ConnectionBuilder builder;
+  builder.host(server.url());
+  builder.httpConnectionLimits(2);
+  auto connection = builder.connect();
+  LoopThreads loop;
+
+  // requests above the limit wait in curl for a free connection
+  std::atomic<int> ok(0);
+  for(int i = 0; i < 20; ++i){
+    connection->sendRequest(fu::createRequest(fu::RestVerb::Get, "/limited")
+                           ,[](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+                              ADD_FAILURE() << fu::to_string(fu::intToError(error));
+                            }
+                           ,[&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){ ++ok; });
+  }
+  // queued requests and requests waiting for a connection are left
+  ASSERT_GT(connection->requestsLeft(), 10u);
+  ASSERT_TRUE(waitFor([&]{ return ok == 20; }));
+  ASSERT_LE(server._connections.load(), 2);
+  ASSERT_EQ(connection->requestsLeft(), 0u);
+
+  // the limits belong to the shared communicator - lift them for the other tests
+  fu::ConnectionBuilder unlimited;
+  unlimited.host(server.url());
+  unlimited.httpConnectionLimits(1024, 1024);
+  unlimited.connect();
+}
+
+TEST(HttpLoopback, CurlLargeBodies){
+  LoopbackHttpServer server;
+  fu::ConnectionBuilder builder;
+  builder.host(server.url());
+  auto connection = builder.connect();
+  LoopThreads loop;
+
+  // curl reads the bodies from the requests it keeps - binary data including
+  // zero bytes comes back unchanged
+  std::size_t const length = 8 * 1024 * 1024;
+  std::vector<fu::RestVerb> verbs{fu::RestVerb::Post, fu::RestVerb::Put, fu::RestVerb::Patch};
+  std::atomic<std::size_t> ok(0);
+  for(std::size_t i = 0; i < verbs.size(); ++i){
+    std::string body(length, '\0');
+    for(std::size_t j = 0; j < length; ++j){
+      body[j] = static_cast<char>((j * 7 + i) % 256);
+    }
+    auto request = fu::createRequest(verbs[i], "/large");
+    request->addBinary(reinterpret_cast<uint8_t const*>(body.data()), body.size());
+    connection->sendRequest(std::move(request)
+                           ,[](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+                              ADD_FAILURE() << fu::to_string(fu::intToError(error));
+                            }
+                           ,[&,body](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response> response){
+                              EXPECT_EQ(response->header.responseCode.get(), 200u);
+                              EXPECT_TRUE(response->payloadAsString() == body);
+                              ++ok;
+                            });
+  }
+  ASSERT_TRUE(waitFor([&]{ return ok == verbs.size(); }));
+  ASSERT_EQ(server._requests.load(), static_cast<int>(verbs.size()));
+}
+
+// outcome of a single request on the asio http connection
+struct AsioResult {
+  std::atomic<bool> done{false};
+  fu::Error error = 0;
+  std::unique_ptr<fu::Response> response;
+};
+
+static void sendAsio(fu::Connection& connection, std::unique_ptr<fu::Request> request, AsioResult& result){
+  connection.sendRequest(std::move(request)
+                        ,[&](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+                           result.error = error;
+                           result.done = true;
+                         }
+                        ,[&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response> response){
+                           result.response = std::move(response);
+                           result.done = true;
+                         });
+}
+
+// url of a loopback port without a listener
+static std::string unreachableUrl(){
+  boost::asio::io_service service;
+  boost::asio::ip::tcp::acceptor acceptor(service, {boost::asio::ip::address_v4::loopback(), 0});
+  return "http://127.0.0.1:" + std::to_string(acceptor.local_endpoint().port());
+}
+
+static std::shared_ptr<fu::Connection> asioConnection(LoopbackHttpServer& server){
+  fu::ConnectionBuilder builder;
+  builder.host(server.url());
+  builder.httpBackend(fu::HttpBackend::Asio);
+  return builder.connect();
+}
+
+TEST(HttpLoopback, AsioResponseBodies){
+  LoopbackHttpServer server;
+  auto connection = asioConnection(server);
+  LoopThreads loop;
+
+  struct Case {
+    std::unique_ptr<fu::Request> request;
+    unsigned code;
+    std::string body;
+  };
+  std::vector<Case> cases;
+  cases.push_back({bodyRequest("/echo", 100000), 200, bodyOf(100000)});          // content length
+  cases.push_back({bodyRequest("/chunked", 5000), 200, bodyOf(5000)});           // chunked with trailer
+  cases.push_back({fu::createRequest(fu::RestVerb::Head, "/head"), 200, ""});    // length without body
+  cases.push_back({fu::createRequest(fu::RestVerb::Get, "/status/204"), 204, ""});
+  cases.push_back({fu::createRequest(fu::RestVerb::Get, "/status/304"), 304, ""});
+  cases.push_back({fu::createRequest(fu::RestVerb::Get, "/interim"), 200, "/interim"});
+  cases.push_back({fu::createRequest(fu::RestVerb::Get, "/after"), 200, "/after"});
+
+  // pipelined on one connection - a misparsed response breaks the following ones
+  std::vector<AsioResult> results(cases.size());
+  for(std::size_t i = 0; i < cases.size(); ++i){
+    sendAsio(*connection, std::move(cases[i].request), results[i]);
+  }
+  for(std::size_t i = 0; i < cases.size(); ++i){
+    ASSERT_TRUE(waitFor([&]{ return results[i].done.load(); })) << i;
+    ASSERT_TRUE(results[i].response) << i << ": " << fu::to_string(fu::intToError(results[i].error));
+    EXPECT_EQ(results[i].response->header.responseCode.get(), cases[i].code) << i;
+    EXPECT_EQ(results[i].response->payloadAsString(), cases[i].body) << i;
+  }
+  ASSERT_EQ(server._connections.load(), 1);
+}
+
+TEST(HttpLoopback, AsioReadUntilClose){
+  LoopbackHttpServer server;
+  auto connection = asioConnection(server);
+  LoopThreads loop;
+
+  // the body ends with the connection - the next request reconnects
+  AsioResult close, next;
+  sendAsio(*connection, fu::createRequest(fu::RestVerb::Get, "/close"), close);
+  ASSERT_TRUE(waitFor([&]{ return close.done.load(); }));
+  ASSERT_TRUE(close.response) << fu::to_string(fu::intToError(close.error));
+  ASSERT_EQ(close.response->payloadAsString(), "/close");
+
+  sendAsio(*connection, fu::createRequest(fu::RestVerb::Get, "/next"), next);
+  ASSERT_TRUE(waitFor([&]{ return next.done.load(); }));
+  ASSERT_TRUE(next.response) << fu::to_string(fu::intToError(next.error));
+  ASSERT_EQ(next.response->payloadAsString(), "/next");
+  ASSERT_EQ(server._connections.load(), 2);
+}
+
+TEST(HttpLoopback, AsioReplayAfterClose){
+  LoopbackHttpServer server;
+  auto connection = asioConnection(server);
+  LoopThreads loop;
+
+  // a written idempotent request is sent again on a new connection
+  server._dropNext = true;
+  AsioResult get;
+  sendAsio(*connection, fu::createRequest(fu::RestVerb::Get, "/replay"), get);
+  ASSERT_TRUE(waitFor([&]{ return get.done.load(); }));
+  ASSERT_TRUE(get.response) << fu::to_string(fu::intToError(get.error));
+  ASSERT_EQ(get.response->payloadAsString(), "/replay");
+  ASSERT_EQ(server._connections.load(), 2);
+
+  // a written POST may have been processed - it fails
+  server._dropNext = true;
+  AsioResult post;
+  sendAsio(*connection, bodyRequest("/post", 10), post);
+  ASSERT_TRUE(waitFor([&]{ return post.done.load(); }));
+  ASSERT_FALSE(post.response);
+  ASSERT_EQ(fu::intToError(post.error), fu::ErrorCondition::ConnectionError);
+  ASSERT_EQ(server._requests.load(), 1);
+}
+
+TEST(HttpLoopback, AsioFailover){
+  LoopbackHttpServer server;
+  std::string unreachable = unreachableUrl();
+  fu::ConnectionBuilder builder;
+  builder.host(unreachable);
+  builder.addHost(server.url());
+  builder.httpBackend(fu::HttpBackend::Asio);
+  auto connection = builder.connect();
+  LoopThreads loop;
+
+  AsioResult result;
+  sendAsio(*connection, fu::createRequest(fu::RestVerb::Get, "/failover"), result);
+  ASSERT_TRUE(waitFor([&]{ return result.done.load(); }));
+  ASSERT_TRUE(result.response) << fu::to_string(fu::intToError(result.error));
+  // the Host field names the host that has been reached
+  ASSERT_EQ(server.hosts(), std::vector<std::string>{server.url().substr(7)});
+}
+
+TEST(HttpLoopback, AsioCouldNotConnect){
+  std::string unreachable = unreachableUrl();
+  fu::ConnectionBuilder builder;
+  builder.host(unreachable);
+  builder.reconnect(2, std::chrono::milliseconds(50));
+  builder.httpBackend(fu::HttpBackend::Asio);
+  auto connection = builder.connect();
+  LoopThreads loop;
+
+  // the queued request fails after the retries with backoff (50ms + 100ms)
+  auto start = std::chrono::steady_clock::now();
+  AsioResult result;
+  sendAsio(*connection, fu::createRequest(fu::RestVerb::Get, "/"), result);
+  ASSERT_TRUE(waitFor([&]{ return result.done.load(); }));
+  ASSERT_FALSE(result.response);
+  ASSERT_EQ(fu::intToError(result.error), fu::ErrorCondition::CouldNotConnect);
+  ASSERT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(150));
+}
+
+TEST(HttpLoopback, AsioClosedWhileIdle){
+  LoopbackHttpServer server;
+  auto connection = asioConnection(server);
+  LoopThreads loop;
+
+  // the server closes the idle connection (keep-alive timeout) - the next
+  // POST must not be written to it
+  server._closeAfterNext = true;
+  AsioResult first, second;
+  sendAsio(*connection, bodyRequest("/post", 10), first);
+  ASSERT_TRUE(waitFor([&]{ return first.done.load(); }));
+  ASSERT_TRUE(first.response) << fu::to_string(fu::intToError(first.error));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  sendAsio(*connection, bodyRequest("/post", 20), second);
+  ASSERT_TRUE(waitFor([&]{ return second.done.load(); }));
+  ASSERT_TRUE(second.response) << fu::to_string(fu::intToError(second.error));
+  ASSERT_EQ(second.response->payloadAsString(), bodyOf(20));
+  ASSERT_EQ(server._connections.load(), 2);
+}
+
+TEST(HttpLoopback, AsioTruncatedBody){
+  LoopbackHttpServer server;
+  auto connection = asioConnection(server);
+  LoopThreads loop;
+
+  // a body that ends with the connection is only complete after a clean
+  // close - a reset truncates it
+  AsioResult reset, next;
+  sendAsio(*connection, bodyRequest("/reset", 1000), reset);
+  ASSERT_TRUE(waitFor([&]{ return reset.done.load(); }));
+  ASSERT_FALSE(reset.response);
+  ASSERT_EQ(fu::intToError(reset.error), fu::ErrorCondition::ConnectionError);
+
+  sendAsio(*connection, fu::createRequest(fu::RestVerb::Get, "/next"), next);
+  ASSERT_TRUE(waitFor([&]{ return next.done.load(); }));
+  ASSERT_TRUE(next.response) << fu::to_string(fu::intToError(next.error));
+  ASSERT_EQ(server._connections.load(), 2);
+}
+
+TEST(HttpLoopback, AsioPipelining){
+  LoopbackHttpServer server;
+  server._delay = 5;
+  auto connection = asioConnection(server);
+  LoopThreads loop;
+
+  // the requests are written without waiting for responses - these arrive
+  // in order on the single connection
+  std::size_t const count = 20;
+  std::vector<AsioResult> results(count);
+  std::mutex mutex;
+  std::vector<std::string> order;
+  for(std::size_t i = 0; i < count; ++i){
+    auto& result = results[i];
+    connection->sendRequest(i % 2 ? bodyRequest("/post", i) : fu::createRequest(fu::RestVerb::Get, "/get/" + std::to_string(i))
+                           ,[&](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+                              result.error = error;
+                              result.done = true;
+                            }
+                           ,[&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response> response){
+                              std::lock_guard<std::mutex> lock(mutex);
+                              order.push_back(response->payloadAsString());
+                              result.response = std::move(response);
+                              result.done = true;
+                            });
+  }
+  ASSERT_TRUE(connection->requestsLeft() > 1u);
+  for(auto& result : results){
+    ASSERT_TRUE(waitFor([&]{ return result.done.load(); }));
+    ASSERT_TRUE(result.response) << fu::to_string(fu::intToError(result.error));
+  }
+  for(std::size_t i = 0; i < count; ++i){
+    ASSERT_EQ(order[i], i % 2 ? bodyOf(i) : "/get/" + std::to_string(i));
+  }
+  ASSERT_EQ(server._connections.load(), 1);
+  ASSERT_EQ(connection->requestsLeft(), 0u);
+}
+
+TEST(HttpLoopback, AsioTimeout){
+  LoopbackHttpServer server;
+  server._delay = 100;
+  auto connection = asioConnection(server);
+  LoopThreads loop;
+
+  // a written request that times out resets the connection - the server
+  // is stuck. The idempotent request written before it is sent again.
+  AsioResult slow, fast;
+  auto request = fu::createRequest(fu::RestVerb::Get, "/slow");
+  request->timeout(std::chrono::milliseconds(5000));
+  sendAsio(*connection, std::move(request), slow);
+  request = fu::createRequest(fu::RestVerb::Get, "/fast");
+  request->timeout(std::chrono::milliseconds(30));
+  auto start = std::chrono::steady_clock::now();
+  sendAsio(*connection, std::move(request), fast);
+  ASSERT_TRUE(waitFor([&]{ return fast.done.load(); }));
+  ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(100));
+  ASSERT_FALSE(fast.response);
+  ASSERT_EQ(fu::intToError(fast.error), fu::ErrorCondition::Timeout);
+
+  ASSERT_TRUE(waitFor([&]{ return slow.done.load(); }));
+  ASSERT_TRUE(slow.response) << fu::to_string(fu::intToError(slow.error));
+  ASSERT_EQ(slow.response->payloadAsString(), "/slow");
+  ASSERT_EQ(server._connections.load(), 2);
+  ASSERT_EQ(connection->requestsLeft(), 0u);
+}
+
+TEST(HttpLoopback, AsioCancel){
+  LoopbackHttpServer server;
+  server._delay = 100;
+  auto connection = asioConnection(server);
+  LoopThreads loop;
+
+  // a queued request is never written - it waits for the retry of an
+  // unreachable server
+  fu::ConnectionBuilder builder;
+  builder.host(unreachableUrl());
+  builder.reconnect(1, std::chrono::milliseconds(200));
+  builder.httpBackend(fu::HttpBackend::Asio);
+  auto unconnected = builder.connect();
+  AsioResult queued;
+  auto id = unconnected->sendRequest(fu::createRequest(fu::RestVerb::Get, "/queued")
+                                   ,[&](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+                                      queued.error = error;
+                                      queued.done = true;
+                                    }
+                                   ,[&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){ queued.done = true; });
+  unconnected->cancel(id);
+  ASSERT_TRUE(waitFor([&]{ return queued.done.load(); }));
+  ASSERT_EQ(fu::intToError(queued.error), fu::ErrorCondition::Canceled);
+  ASSERT_EQ(unconnected->requestsLeft(), 0u);
+
+  // a written request fails right away - its late response is dropped and
+  // the connection is kept
+  AsioResult written, next;
+  id = connection->sendRequest(fu::createRequest(fu::RestVerb::Get, "/written")
+                              ,[&](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+                                 written.error = error;
+                                 written.done = true;
+                               }
+                              ,[&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){ written.done = true; });
+  ASSERT_TRUE(waitFor([&]{ return server.hosts().size() == 1; }));
+  auto start = std::chrono::steady_clock::now();
+  connection->cancel(id);
+  ASSERT_TRUE(waitFor([&]{ return written.done.load(); }));
+  ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(80));
+  ASSERT_EQ(fu::intToError(written.error), fu::ErrorCondition::Canceled);
+
+  sendAsio(*connection, fu::createRequest(fu::RestVerb::Get, "/next"), next);
+  ASSERT_TRUE(waitFor([&]{ return next.done.load(); }));
+  ASSERT_TRUE(next.response) << fu::to_string(fu::intToError(next.error));
+  ASSERT_EQ(next.response->payloadAsString(), "/next");
+  ASSERT_EQ(server.hosts().size(), 2u);
+  ASSERT_EQ(server._connections.load(), 1);
+  ASSERT_EQ(connection->requestsLeft(), 0u);
+}
@@ -0,0 +1,138 @@
+////////////////////////////////////////////////////////////////////////////////
+/// DISCLAIMER
+///
+/// Copyright 2016 ArangoDB GmbH, Cologne, Germany
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+///
+/// Copyright holder is ArangoDB GmbH, Cologne, Germany
+///
+/// @author Jan Christoph Uhde
+////////////////////////////////////////////////////////////////////////////////
+#include "test_main.h"
+#include "MessageStore.h"
+
+#include <algorithm>
+
+namespace fu = ::arangodb::fuerte;
+
+namespace {
+struct Item {
+  explicit Item(fu::MessageID id) : _messageId(id) {}
+  fu::MessageID _messageId;
+};
+
+using Store = fu::MessageStore<Item>;
+
+std::shared_ptr<Item> item(fu::MessageID id){
+  return std::make_shared<Item>(id);
+}
+
+std::vector<fu::MessageID> ids(std::vector<std::shared_ptr<Item>> const& items){
+  std::vector<fu::MessageID> rv;
+  for(auto const& item : items){
+    rv.push_back(item->_messageId);
+  }
+  std::sort(rv.begin(), rv.end());
+  return rv;
+}
+}
+
+TEST(MessageStore, AddFindErase){
+  Store store(8);
+  ASSERT_TRUE(store.empty());
+  store.add(item(1));
+  store.add(item(2));
+  ASSERT_EQ(store.size(), 2u);
+  ASSERT_EQ(store.find(1)->_messageId, 1u);
+  ASSERT_EQ(store.find(2)->_messageId, 2u);
+  ASSERT_FALSE(store.find(3));
+
+  auto erased = store.erase(1);
+  ASSERT_TRUE(erased);
+  ASSERT_EQ(erased->_messageId, 1u);
+  // only the first erase gets the item
+  ASSERT_FALSE(store.erase(1));
+  ASSERT_FALSE(store.find(1));
+  ASSERT_EQ(store.size(), 1u);
+}
+
+TEST(MessageStore, CapacityIsRoundedUp){
+  ASSERT_EQ(Store(5).capacity(), 8u);
+  ASSERT_EQ(Store(8).capacity(), 8u);
+}
+
+TEST(MessageStore, Collision){
+  Store store(8);
+  // 1, 9 and 17 share a slot - the later ones go to the overflow map
+  store.add(item(1));
+  store.add(item(9));
+  store.add(item(17));
+  ASSERT_EQ(store.capacity(), 8u);
+  ASSERT_EQ(store.size(), 3u);
+  ASSERT_EQ(store.find(9)->_messageId, 9u);
+  ASSERT_EQ(store.find(17)->_messageId, 17u);
+
+  // the slot is free again while 9 and 17 are still found
+  ASSERT_TRUE(store.erase(1));
+  ASSERT_FALSE(store.find(1));
+  ASSERT_EQ(store.find(9)->_messageId, 9u);
+  ASSERT_TRUE(store.erase(17));
+  ASSERT_FALSE(store.find(17));
+  ASSERT_TRUE(store.erase(9));
+  ASSERT_TRUE(store.empty());
+
+  store.add(item(25));
+  ASSERT_EQ(store.find(25)->_messageId, 25u);
+}
+
+TEST(MessageStore, Wraparound){
+  Store store(8);
+  // increasing ids with a few of them in flight reuse the slots
+  std::size_t const inFlight = 6;
+  for(fu::MessageID id = 1; id < 1000; ++id){
+    store.add(item(id));
+    if(id > inFlight){
+      ASSERT_EQ(store.erase(id - inFlight)->_messageId, id - inFlight);
+    }
+    for(fu::MessageID live = id > inFlight ? id - inFlight + 1 : 1; live <= id; ++live){
+      ASSERT_TRUE(store.find(live));
+    }
+    ASSERT_LE(store.size(), inFlight);
+  }
+  ASSERT_EQ(store.capacity(), 8u);
+}
+
+TEST(MessageStore, Clear){
+  Store store(8);
+  for(fu::MessageID id : {3, 4, 11, 12, 19}){
+    store.add(item(id));
+  }
+
+  // items() leaves the store unchanged
+  auto all = ids(store.items());
+  ASSERT_EQ(all, (std::vector<fu::MessageID>{3, 4, 11, 12, 19}));
+  ASSERT_EQ(store.size(), 5u);
+
+  auto cleared = ids(store.clear());
+  ASSERT_EQ(cleared, (std::vector<fu::MessageID>{3, 4, 11, 12, 19}));
+  ASSERT_TRUE(store.empty());
+  for(fu::MessageID id : {3, 4, 11, 12, 19}){
+    ASSERT_FALSE(store.find(id));
+    ASSERT_FALSE(store.erase(id));
+  }
+  ASSERT_TRUE(store.items().empty());
+
+  store.add(item(11));
+  ASSERT_EQ(store.find(11)->_messageId, 11u);
+}
@@ -0,0 +1,130 @@
+////////////////////////////////////////////////////////////////////////////////
+/// DISCLAIMER
+///
+/// Copyright 2016 ArangoDB GmbH, Cologne, Germany
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+///
+/// Copyright holder is ArangoDB GmbH, Cologne, Germany
+///
+/// @author Jan Christoph Uhde
+////////////////////////////////////////////////////////////////////////////////
+#include "test_main.h"
+#include "TimerWheel.h"
+
+#include <algorithm>
+
+namespace fu = ::arangodb::fuerte;
+
+// all points in time are derived from timeOf(), so the tests do not depend
+// on the clock
+using ms = std::chrono::milliseconds;
+
+static std::vector<fu::MessageID> sorted(std::vector<fu::MessageID> ids){
+  std::sort(ids.begin(), ids.end());
+  return ids;
+}
+
+TEST(TimerWheel, AddRemove){
+  fu::TimerWheel wheel(ms(10), 1024);
+  ASSERT_TRUE(wheel.empty());
+  auto tick = wheel.add(1, wheel.timeOf(0) + ms(50));
+  ASSERT_EQ(tick, 5u);
+  wheel.add(2, wheel.timeOf(0) + ms(50));
+  ASSERT_EQ(wheel.size(), 2u);
+
+  wheel.remove(1, tick);
+  ASSERT_EQ(wheel.size(), 1u);
+  wheel.remove(1, tick); // removing twice is harmless
+  ASSERT_EQ(wheel.size(), 1u);
+  ASSERT_EQ(wheel.advance(wheel.timeOf(5)), std::vector<fu::MessageID>{2});
+  ASSERT_TRUE(wheel.empty());
+}
+
+TEST(TimerWheel, RoundsUp){
+  fu::TimerWheel wheel(ms(10), 1024);
+  // entries never expire early
+  ASSERT_EQ(wheel.add(1, wheel.timeOf(0) + ms(41)), 5u);
+  ASSERT_TRUE(wheel.advance(wheel.timeOf(4) + ms(9)).empty());
+  ASSERT_EQ(wheel.advance(wheel.timeOf(5)), std::vector<fu::MessageID>{1});
+  // an expiry in the past is due in the next tick
+  ASSERT_EQ(wheel.add(2, wheel.timeOf(1)), 6u);
+}
+
+TEST(TimerWheel, Advance){
+  fu::TimerWheel wheel(ms(10), 1024);
+  wheel.add(1, wheel.timeOf(5));
+  wheel.add(2, wheel.timeOf(7));
+  wheel.add(3, wheel.timeOf(7));
+  ASSERT_TRUE(wheel.advance(wheel.timeOf(4)).empty());
+  ASSERT_EQ(wheel.advance(wheel.timeOf(6)), std::vector<fu::MessageID>{1});
+  // going back in time does nothing
+  ASSERT_TRUE(wheel.advance(wheel.timeOf(3)).empty());
+  ASSERT_EQ(sorted(wheel.advance(wheel.timeOf(7))), (std::vector<fu::MessageID>{2, 3}));
+  ASSERT_TRUE(wheel.empty());
+}
+
+TEST(TimerWheel, AdvanceAcrossWrap){
+  fu::TimerWheel wheel(ms(10), 1024);
+  ASSERT_TRUE(wheel.advance(wheel.timeOf(1000)).empty());
+  wheel.add(1, wheel.timeOf(1010));
+  wheel.add(2, wheel.timeOf(1030)); // slot 6
+  wheel.add(3, wheel.timeOf(2050)); // slot 2 - visited at tick 1026, but due later
+  ASSERT_EQ(sorted(wheel.advance(wheel.timeOf(1100))), (std::vector<fu::MessageID>{1, 2}));
+  ASSERT_EQ(wheel.size(), 1u);
+  ASSERT_TRUE(wheel.advance(wheel.timeOf(2049)).empty());
+  ASSERT_EQ(wheel.advance(wheel.timeOf(2050)), std::vector<fu::MessageID>{3});
+}
+
+TEST(TimerWheel, MoreThanOneRevolutionAhead){
+  fu::TimerWheel wheel(ms(10), 1024);
+  // shares slot 476 with tick 476 - the stored tick tells them apart
+  ASSERT_EQ(wheel.add(1, wheel.timeOf(1500)), 1500u);
+  wheel.add(2, wheel.timeOf(476));
+  ASSERT_EQ(wheel.advance(wheel.timeOf(476)), std::vector<fu::MessageID>{2});
+  ASSERT_EQ(wheel.size(), 1u);
+  ASSERT_TRUE(wheel.advance(wheel.timeOf(1499)).empty());
+  ASSERT_EQ(wheel.advance(wheel.timeOf(1500)), std::vector<fu::MessageID>{1});
+}
+
+TEST(TimerWheel, AdvanceFarAhead){
+  fu::TimerWheel wheel(ms(10), 16);
+  // every slot is visited once, even if many revolutions have passed
+  for(fu::MessageID id = 1; id <= 40; ++id){
+    wheel.add(id, wheel.timeOf(id * 3));
+  }
+  auto expired = wheel.advance(wheel.timeOf(100));
+  ASSERT_EQ(expired.size(), 33u); // ticks 3 .. 99
+  ASSERT_EQ(wheel.size(), 7u);
+  ASSERT_EQ(wheel.advance(wheel.timeOf(1000)).size(), 7u);
+  ASSERT_TRUE(wheel.empty());
+}
+
+TEST(TimerWheel, NextExpiry){
+  fu::TimerWheel wheel(ms(10), 1024);
+  // nothing to wait for - one revolution ahead
+  ASSERT_EQ(wheel.nextExpiry(), wheel.timeOf(1024));
+
+  wheel.add(1, wheel.timeOf(30));
+  wheel.add(2, wheel.timeOf(20));
+  ASSERT_EQ(wheel.nextExpiry(), wheel.timeOf(20));
+  wheel.advance(wheel.timeOf(20));
+  ASSERT_EQ(wheel.nextExpiry(), wheel.timeOf(30));
+
+  // an entry of a later round makes its slot due early
+  wheel.advance(wheel.timeOf(30));
+  wheel.add(3, wheel.timeOf(1100));
+  ASSERT_EQ(wheel.nextExpiry(), wheel.timeOf(1100 - 1024));
+  wheel.advance(wheel.timeOf(1100 - 1024));
+  ASSERT_EQ(wheel.nextExpiry(), wheel.timeOf(1100));
+}
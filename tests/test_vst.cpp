@@ -20,8 +20,141 @@
 /// @author Jan Christoph Uhde
 ////////////////////////////////////////////////////////////////////////////////
 #include "test_main.h"
+#include <fuerte/fuerte.h>
+#include <fuerte/vst.h>
+
+namespace fu = ::arangodb::fuerte;
+
+// creates a request with a single string slice of the given length as payload
+static std::unique_ptr<fu::Request> requestWithPayload(std::size_t length){
+  auto request = fu::createRequest(fu::RestVerb::Post, "/_api/document/test");
+  request->messageid = 42;
+  fu::VBuilder builder;
+  builder.add(fu::VValue(std::string(length, 'x')));
+  request->addVPack(builder.slice());
+  return request;
+}
 
 
 TEST(VSTBasic, PackUnpack){
   ASSERT_TRUE(true); //TODO -- DELETE
 }
+
+TEST(VSTBasic, SingleChunkRequest){
+  auto request = requestWithPayload(100);
+  auto buffer = fu::vst::toNetwork(*request, 5000);
+  auto chunkLength = fu::vst::isChunkComplete(buffer->data(), buffer->byteSize());
+  ASSERT_EQ(chunkLength, buffer->byteSize());
+  auto header = fu::vst::readChunkHeaderV1_0(buffer->data());
+  ASSERT_TRUE(header._isSingle);
+  ASSERT_EQ(header._messageID, 42u);
+}
+
+TEST(VSTBasic, MultiChunkRequest){
+  std::size_t const maxChunkSize = 1000;
+  auto request = requestWithPayload(10000);
+  auto buffer = fu::vst::toNetwork(*request, maxChunkSize);
+
+  // reassemble the message from the chunks
+  fu::VBuffer message;
+  uint8_t const* cursor = buffer->data();
+  std::size_t left = buffer->byteSize();
+  std::size_t chunks = 0;
+  std::size_t numberOfChunks = 0;
+  std::size_t totalMessageLength = 0;
+  while(left){
+    auto chunkLength = fu::vst::isChunkComplete(cursor, left);
+    ASSERT_GT(chunkLength, 0u);
+    ASSERT_LE(chunkLength, maxChunkSize);
+    auto header = fu::vst::readChunkHeaderV1_0(cursor);
+    ASSERT_EQ(header._messageID, 42u);
+    if(chunks == 0){
+      ASSERT_TRUE(header._isFirst);
+      ASSERT_FALSE(header._isSingle);
+      numberOfChunks = header._numberOfChunks;
+      totalMessageLength = header._totalMessageLength;
+    } else {
+      ASSERT_FALSE(header._isFirst);
+      ASSERT_EQ(header._numberOfChunks, chunks); // chunk number for follow-ups
+    }
+    message.append(cursor + header._chunkHeaderLength, header._chunkPayloadLength);
+    cursor += chunkLength;
+    left -= chunkLength;
+    ++chunks;
+  }
+  ASSERT_EQ(chunks, numberOfChunks);
+  ASSERT_EQ(message.byteSize(), totalMessageLength);
+
+  std::size_t headerLength;
+  auto header = fu::vst::validateAndExtractMessageHeader(1, message.data(), message.byteSize(), headerLength);
+  ASSERT_EQ(header.path.get(), "/_api/document/test");
+  ASSERT_EQ(fu::VSlice(message.data() + headerLength).copyString(), std::string(10000, 'x'));
+}
+
+TEST(VSTBasic, SharedPayload){
+  auto buffer = std::make_shared<fu::VBuffer>();
+  buffer->append("head", 4);
+  fu::VBuilder builder;
+  builder.add(fu::VValue(std::string(500, 'y')));
+  buffer->append(builder.slice().start(), builder.slice().byteSize());
+
+  fu::Response response;
+  std::shared_ptr<uint8_t const> payload(buffer, buffer->data() + 4);
+  response.addVPack(payload, builder.slice().byteSize());
+  buffer.reset(); // the response keeps the buffer alive
+
+  ASSERT_EQ(response.payload().first, payload.get()); // no copy
+  ASSERT_EQ(response.payload().second, builder.slice().byteSize());
+  ASSERT_EQ(response.slices().size(), 1u);
+  ASSERT_EQ(response.slices().front().copyString(), std::string(500, 'y'));
+}
+
+TEST(VSTBasic, AuthenticationMessage){
+  auto request = fu::createAuthenticationRequest("user", "password");
+  request->messageid = 1;
+  auto buffer = fu::vst::toNetwork(*request, 5000);
+  auto header = fu::vst::readChunkHeaderV1_0(buffer->data());
+  ASSERT_TRUE(header._isSingle);
+
+  // [version, 1000, "plain", user, password]
+  auto slice = fu::VSlice(buffer->data() + header._chunkHeaderLength);
+  ASSERT_EQ(slice.length(), 5u);
+  ASSERT_EQ(slice.at(1).getInt(), 1000);
+  ASSERT_EQ(slice.at(2).copyString(), "plain");
+
+  std::size_t headerLength;
+  auto messageHeader = fu::vst::validateAndExtractMessageHeader(1, buffer->data() + header._chunkHeaderLength
+                                                               ,header._chunkPayloadLength, headerLength);
+  ASSERT_EQ(messageHeader.type.get(), fu::MessageType::Authentication);
+  ASSERT_EQ(messageHeader.user.get(), "user");
+  ASSERT_EQ(messageHeader.password.get(), "password");
+}
+
+TEST(VSTBasic, ChunkHeaderV1_1){
+  auto request = requestWithPayload(3000);
+  auto buffer = fu::vst::toNetwork(*request, 1000, 2);
+
+  // every chunk carries the total message length
+  uint8_t const* cursor = buffer->data();
+  std::size_t left = buffer->byteSize();
+  std::size_t totalMessageLength = 0;
+  while(left){
+    auto chunkLength = fu::vst::isChunkComplete(cursor, left);
+    ASSERT_GT(chunkLength, 0u);
+    auto header = fu::vst::readChunkHeader(2, cursor);
+    ASSERT_EQ(header._chunkHeaderLength, 24u);
+    if(header._isFirst){
+      totalMessageLength = header._totalMessageLength;
+    }
+    ASSERT_EQ(header._totalMessageLength, totalMessageLength);
+    cursor += chunkLength;
+    left -= chunkLength;
+  }
+
+  auto single = requestWithPayload(10);
+  buffer = fu::vst::toNetwork(*single, 1000, 2);
+  auto header = fu::vst::readChunkHeader(2, buffer->data());
+  ASSERT_TRUE(header._isSingle);
+  ASSERT_EQ(header._chunkHeaderLength, 24u);
+  ASSERT_EQ(header._totalMessageLength, header._chunkPayloadLength);
+}
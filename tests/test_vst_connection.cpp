@@ -0,0 +1,797 @@
+////////////////////////////////////////////////////////////////////////////////
+/// DISCLAIMER
+///
+/// Copyright 2016 ArangoDB GmbH, Cologne, Germany
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+///
+/// Copyright holder is ArangoDB GmbH, Cologne, Germany
+///
+/// @author Jan Christoph Uhde
+////////////////////////////////////////////////////////////////////////////////
+#include "test_main.h"
+#include "loopback_server.h"
+
+#include <set>
+
+// runtime behaviour of VstConnection against LoopbackVstServer
+
+// creates a request with a single string slice of the given length as payload
+static std::unique_ptr<fu::Request> echoRequest(std::size_t length){
+  auto request = fu::createRequest(fu::RestVerb::Post, "/_api/echo");
+  if(length){
+    fu::VBuilder builder;
+    builder.add(fu::VValue(std::string(length, 'a' + length % 26)));
+    request->addVPack(builder.slice());
+  }
+  return request;
+}
+
+// the body the server returns for echoRequest(length)
+static std::string echoed(std::size_t length){
+  return length ? std::string(length, 'a' + length % 26) : std::string("/_api/echo");
+}
+
+TEST(VstLoopback, InterleavedChunks){
+  LoopbackVstServer server;
+  fu::ConnectionBuilder builder;
+  builder.host(server.url()).maxChunkSize(1000);
+  auto connection = builder.connect();
+
+  // both requests are queued before the connection is established
+  std::atomic<int> ok(0);
+  fu::OnErrorCallback onError = [](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+    ADD_FAILURE() << fu::to_string(fu::intToError(error));
+  };
+  auto large = connection->sendRequest(echoRequest(100000), onError
+                                      ,[&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response> response){
+                                        EXPECT_EQ(response->slices().front().copyString(), echoed(100000));
+                                        ++ok;
+                                      });
+  auto small = connection->sendRequest(echoRequest(10), onError
+                                      ,[&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response> response){
+                                        EXPECT_EQ(response->slices().front().copyString(), echoed(10));
+                                        ++ok;
+                                      });
+  fu::run();
+  ASSERT_EQ(ok.load(), 2);
+
+  // the small request is not stuck behind the chunks of the large one
+  auto chunks = server.receivedChunks();
+  std::size_t smallAt = 0, largeLast = 0, largeChunks = 0;
+  for(std::size_t i = 0; i < chunks.size(); ++i){
+    if(chunks[i].first == small){
+      smallAt = i;
+    } else if(chunks[i].first == large){
+      largeLast = i;
+      ++largeChunks;
+    }
+  }
+  ASSERT_GT(largeChunks, 100u);
+  ASSERT_EQ(smallAt, 1u);
+  ASSERT_GT(largeLast, smallAt);
+}
+
+TEST(VstLoopback, BatchedWrites){
+  LoopbackVstServer server;
+  server._responseChunkSize = 3000;
+  fu::ConnectionBuilder builder;
+  builder.host(server.url()).maxChunkSize(1000);
+  auto connection = builder.connect();
+
+  // writes are split at maxWriteBatchSize - some requests exceed it on
+  // their own, many small ones share a write
+  std::size_t const count = 500;
+  std::atomic<std::size_t> ok(0), failed(0);
+  for(std::size_t i = 0; i < count; ++i){
+    std::size_t length = i % 100 == 0 ? 300000 + i : (i % 7) * 13;
+    connection->sendRequest(echoRequest(length)
+                           ,[&](fu::Error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){ ++failed; }
+                           ,[&,length](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response> response){
+                              EXPECT_EQ(response->slices().front().copyString(), echoed(length));
+                              ++ok;
+                            });
+  }
+  fu::run();
+  ASSERT_EQ(failed.load(), 0u);
+  ASSERT_EQ(ok.load(), count);
+  ASSERT_EQ(connection->requestsLeft(), 0u);
+}
+
+TEST(VstLoopback, SingleChunkResponses){
+  LoopbackVstServer server;
+  fu::ConnectionBuilder builder;
+  builder.host(server.url());
+  auto connection = builder.connect();
+
+  // the responses reference the receive buffer - they stay valid while
+  // the connection reads into new ones
+  std::vector<std::unique_ptr<fu::Response>> responses;
+  std::vector<std::size_t> lengths = {0, 10, 1000, 20000, 40000, 10, 20000};
+  for(auto length : lengths){
+    connection->sendRequest(echoRequest(length)
+                           ,[](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+                              ADD_FAILURE() << fu::to_string(fu::intToError(error));
+                            }
+                           ,[&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response> response){
+                              responses.push_back(std::move(response));
+                            });
+  }
+  fu::run();
+  ASSERT_EQ(responses.size(), lengths.size());
+  // requests that fit into a single chunk overtake multi chunk ones
+  std::multiset<std::string> expected, received;
+  for(std::size_t i = 0; i < lengths.size(); ++i){
+    expected.insert(echoed(lengths[i]));
+    received.insert(responses[i]->slices().front().copyString());
+  }
+  ASSERT_TRUE(received == expected);
+}
+
+TEST(VstLoopback, SmallReceiveBuffer){
+  LoopbackVstServer server;
+  server._responseChunkSize = 3000;
+  fu::ConnectionBuilder builder;
+  // chunks do not fit into the buffer - it grows for them and shrinks again
+  builder.host(server.url()).receiveBufferSize(1024);
+  auto connection = builder.connect();
+
+  std::size_t const count = 200;
+  std::atomic<std::size_t> ok(0), failed(0);
+  for(std::size_t i = 0; i < count; ++i){
+    std::size_t length = (i % 11) * 700;
+    connection->sendRequest(echoRequest(length)
+                           ,[&](fu::Error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){ ++failed; }
+                           ,[&,length](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response> response){
+                              EXPECT_EQ(response->slices().front().copyString(), echoed(length));
+                              ++ok;
+                            });
+  }
+  fu::run();
+  ASSERT_EQ(failed.load(), 0u);
+  ASSERT_EQ(ok.load(), count);
+}
+
+TEST(VstLoopback, ConcurrentProducers){
+  LoopbackVstServer server;
+  fu::ConnectionBuilder builder;
+  builder.host(server.url()).maxChunkSize(1000);
+  auto connection = builder.connect();
+
+  // requests are queued from several threads while the loop is running
+  LoopThreads loop;
+  std::size_t const producers = 4;
+  std::size_t const count = 500;
+  std::atomic<std::size_t> ok(0), failed(0);
+  std::vector<std::thread> threads;
+  for(std::size_t p = 0; p < producers; ++p){
+    threads.emplace_back([&]{
+      for(std::size_t i = 0; i < count; ++i){
+        std::size_t length = (i % 13) * 300;
+        connection->sendRequest(echoRequest(length)
+                               ,[&](fu::Error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){ ++failed; }
+                               ,[&,length](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response> response){
+                                  EXPECT_EQ(response->slices().front().copyString(), echoed(length));
+                                  ++ok;
+                                });
+      }
+    });
+  }
+  for(auto& thread : threads){
+    thread.join();
+  }
+  ASSERT_TRUE(waitFor([&]{ return ok + failed == producers * count; }));
+  ASSERT_EQ(failed.load(), 0u);
+  ASSERT_EQ(connection->requestsLeft(), 0u);
+}
+
+TEST(VstLoopback, Timeout){
+  LoopbackVstServer server;
+  server._delay = 300;
+  fu::ConnectionBuilder builder;
+  builder.host(server.url()).requestTimeout(std::chrono::milliseconds(50));
+  auto connection = builder.connect();
+
+  LoopThreads loop;
+  std::atomic<int> timeouts(0), ok(0);
+  auto start = std::chrono::steady_clock::now();
+  std::atomic<long> elapsed(0);
+  for(int i = 0; i < 3; ++i){
+    connection->sendRequest(echoRequest(10)
+                           ,[&](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+                              EXPECT_EQ(error, fu::errorToInt(fu::ErrorCondition::Timeout));
+                              ++timeouts;
+                              elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+                            }
+                           ,[&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){ ++ok; });
+  }
+  // a request may extend the default
+  auto request = echoRequest(20);
+  request->timeout(std::chrono::milliseconds(10000));
+  connection->sendRequest(std::move(request)
+                         ,[](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+                            ADD_FAILURE() << fu::to_string(fu::intToError(error));
+                          }
+                         ,[&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){ ++ok; });
+  ASSERT_TRUE(waitFor([&]{ return ok == 1; }));
+  ASSERT_EQ(timeouts.load(), 3);
+  // the timeouts fire long before the responses arrive
+  ASSERT_LT(elapsed.load(), 250);
+  // late responses are dropped
+  ASSERT_TRUE(waitFor([&]{ return server._requests == 4; }));
+  ASSERT_EQ(connection->requestsLeft(), 0u);
+}
+
+TEST(VstLoopback, Cancel){
+  LoopbackVstServer server;
+  server._delay = 200;
+  fu::ConnectionBuilder builder;
+  builder.host(server.url());
+  auto connection = builder.connect();
+
+  std::atomic<int> canceled(0), ok(0), failed(0);
+  fu::OnErrorCallback onError = [&](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+    if(error == fu::errorToInt(fu::ErrorCondition::Canceled)){
+      ++canceled;
+    } else {
+      ++failed;
+    }
+  };
+  fu::OnSuccessCallback onSuccess = [&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){ ++ok; };
+
+  // canceled before it is written - the writer skips it
+  auto queued = connection->sendRequest(echoRequest(10), onError, onSuccess);
+  connection->cancel(queued);
+  ASSERT_EQ(canceled.load(), 1);
+
+  LoopThreads loop;
+  std::vector<fu::MessageID> ids;
+  for(int i = 0; i < 4; ++i){
+    ids.push_back(connection->sendRequest(echoRequest(10), onError, onSuccess));
+  }
+  ASSERT_TRUE(waitFor([&]{ return server._requests >= 1; }));
+  // canceled while waiting for the response - the callback is called once
+  connection->cancel(ids[1]);
+  connection->cancel(ids[1]);
+  connection->cancel(ids[3]);
+  ASSERT_EQ(canceled.load(), 3);
+  ASSERT_TRUE(waitFor([&]{ return ok == 2; }));
+  // the responses of canceled requests are dropped
+  ASSERT_TRUE(waitFor([&]{ return server._requests >= 4; }));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  ASSERT_EQ(ok.load(), 2);
+  ASSERT_EQ(canceled.load(), 3);
+  ASSERT_EQ(failed.load(), 0);
+  ASSERT_EQ(connection->requestsLeft(), 0u);
+  // unknown ids are ignored
+  connection->cancel(ids[0]);
+  connection->cancel(12345);
+  ASSERT_EQ(canceled.load(), 3);
+}
+
+TEST(VstLoopback, PoolSelection){
+  LoopbackVstServer server;
+  fu::ConnectionBuilder builder;
+  builder.host(server.url());
+  auto pool = builder.connectPool(3);
+  ASSERT_EQ(pool->size(), 3u);
+
+  std::atomic<int> ok(0), canceled(0), failed(0);
+  fu::OnErrorCallback onError = [&](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+    if(error == fu::errorToInt(fu::ErrorCondition::Canceled)){
+      ++canceled;
+    } else {
+      ++failed;
+    }
+  };
+  fu::OnSuccessCallback onSuccess = [&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){ ++ok; };
+
+  // requests go to the connection with the fewest requests left - the
+  // connection is encoded in the upper bits of the message id
+  std::vector<int> perConnection(3, 0);
+  std::vector<fu::MessageID> ids;
+  for(int i = 0; i < 9; ++i){
+    auto id = pool->sendRequest(echoRequest(10), onError, onSuccess);
+    ids.push_back(id);
+    ++perConnection.at(id >> 48);
+  }
+  ASSERT_EQ(perConnection, (std::vector<int>{3, 3, 3}));
+  ASSERT_EQ(pool->requestsLeft(), 9u);
+
+  // the pool routes cancel() to the connection of the request
+  pool->cancel(ids[4]);
+  ASSERT_EQ(canceled.load(), 1);
+  ASSERT_EQ(pool->requestsLeft(), 8u);
+
+  // the connection with the canceled request is preferred
+  auto id = pool->sendRequest(echoRequest(10), onError, onSuccess);
+  ASSERT_EQ(id >> 48, ids[4] >> 48);
+
+  fu::run();
+  ASSERT_EQ(ok.load(), 9);
+  ASSERT_EQ(failed.load(), 0);
+  ASSERT_EQ(pool->requestsLeft(), 0u);
+  ASSERT_EQ(server._connections.load(), 3);
+}
+
+TEST(VstLoopback, Failover){
+  LoopbackVstServer server;
+  fu::ConnectionBuilder builder;
+  // refused, not resolvable, reachable
+  builder.host("vst://127.0.0.1:1")
+         .addHost("vst://host.invalid:8529")
+         .addHost(server.url())
+         .connectTimeout(std::chrono::milliseconds(1000));
+  auto connection = builder.connect();
+  auto response = connection->sendRequest(echoRequest(10));
+  ASSERT_TRUE(response);
+  ASSERT_EQ(response->slices().front().copyString(), echoed(10));
+  ASSERT_EQ(server._connections.load(), 1);
+}
+
+TEST(VstLoopback, NoHostReachable){
+  fu::ConnectionBuilder builder;
+  builder.host("vst://127.0.0.1:1").reconnect(2, std::chrono::milliseconds(5));
+  auto connection = builder.connect();
+
+  std::vector<fu::Error> errors;
+  fu::OnErrorCallback onError = [&](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+    errors.push_back(error);
+  };
+  fu::OnSuccessCallback onSuccess = [](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+    ADD_FAILURE() << "unexpected response";
+  };
+  connection->sendRequest(echoRequest(10), onError, onSuccess);
+  connection->sendRequest(echoRequest(10), onError, onSuccess);
+  fu::run();
+  ASSERT_EQ(errors, std::vector<fu::Error>(2, fu::errorToInt(fu::ErrorCondition::CouldNotConnect)));
+
+  // the next request tries again
+  connection->sendRequest(echoRequest(10), onError, onSuccess);
+  fu::run();
+  ASSERT_EQ(errors.size(), 3u);
+  ASSERT_EQ(connection->requestsLeft(), 0u);
+}
+
+TEST(VstLoopback, ReconnectReplay){
+  LoopbackVstServer server;
+  fu::ConnectionBuilder builder;
+  builder.host(server.url());
+  auto connection = builder.connect();
+
+  std::vector<fu::Error> errors;
+  std::vector<std::string> responses;
+  fu::OnErrorCallback onError = [&](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+    errors.push_back(error);
+  };
+  fu::OnSuccessCallback onSuccess = [&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response> response){
+    responses.push_back(response->slices().front().copyString());
+  };
+
+  // a written POST may have been executed - it is not sent again
+  server._dropNext = true;
+  connection->sendRequest(echoRequest(10), onError, onSuccess);
+  fu::run();
+  ASSERT_EQ(errors, std::vector<fu::Error>{fu::errorToInt(fu::ErrorCondition::VstCanceldDuringReset)});
+  ASSERT_TRUE(responses.empty());
+
+  // GET is sent again on the new connection
+  server._dropNext = true;
+  connection->sendRequest(fu::createRequest(fu::RestVerb::Get, "/_api/version"), onError, onSuccess);
+  fu::run();
+  ASSERT_EQ(responses, std::vector<std::string>{"/_api/version"});
+
+  // so is a POST that has been marked as idempotent
+  server._dropNext = true;
+  auto request = echoRequest(20);
+  request->idempotent(true);
+  connection->sendRequest(std::move(request), onError, onSuccess);
+  fu::run();
+  ASSERT_EQ(responses.size(), 2u);
+  ASSERT_EQ(responses.back(), echoed(20));
+  ASSERT_EQ(errors.size(), 1u);
+  ASSERT_EQ(server._connections.load(), 4);
+  ASSERT_EQ(connection->requestsLeft(), 0u);
+}
+
+TEST(VstLoopback, ReconnectUnderLoad){
+  LoopbackVstServer server;
+  server._responseChunkSize = 3000;
+  fu::ConnectionBuilder builder;
+  builder.host(server.url()).maxChunkSize(1000).receiveBufferSize(1024);
+  auto connection = builder.connect();
+
+  // connections are lost while requests are written and responses are
+  // received - idempotent requests survive all of it
+  LoopThreads loop;
+  std::size_t const count = 1000;
+  std::atomic<std::size_t> ok(0), failed(0);
+  for(std::size_t i = 0; i < count; ++i){
+    if(i == 300 || i == 600){
+      server._dropNext = true;
+    }
+    std::size_t length = (i % 7) * 300;
+    auto request = echoRequest(length);
+    request->idempotent(true);
+    connection->sendRequest(std::move(request)
+                           ,[&](fu::Error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){ ++failed; }
+                           ,[&,length](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response> response){
+                              EXPECT_EQ(response->slices().front().copyString(), echoed(length));
+                              ++ok;
+                            });
+  }
+  ASSERT_TRUE(waitFor([&]{ return ok + failed == count; }));
+  ASSERT_EQ(failed.load(), 0u);
+  ASSERT_GE(server._connections.load(), 2);
+}
+
+TEST(VstLoopback, Tls){
+  LoopbackVstServer server(true);
+  server._responseChunkSize = 3000;
+  fu::ConnectionBuilder builder;
+  builder.host(server.url()).maxChunkSize(1000);
+  auto connection = builder.connect();
+
+  // requests and responses of one and of several chunks
+  std::vector<std::size_t> lengths{0, 10, 900, 2500, 10000};
+  std::multiset<std::string> expected, responses;
+  std::size_t errors = 0;
+  for(std::size_t length : lengths){
+    expected.insert(echoed(length));
+    connection->sendRequest(echoRequest(length)
+                           ,[&](fu::Error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){ ++errors; }
+                           ,[&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response> response){
+                              responses.insert(response->slices().front().copyString());
+                            });
+  }
+  fu::run();
+  ASSERT_EQ(errors, 0u);
+  ASSERT_EQ(responses, expected);
+  ASSERT_EQ(server._connections.load(), 1);
+}
+
+TEST(VstLoopback, TlsSessionResumption){
+  LoopbackVstServer server(true);
+  fu::ConnectionBuilder builder;
+  builder.host(server.url());
+  auto connection = builder.connect();
+
+  std::vector<std::string> responses;
+  fu::OnErrorCallback onError = [&](fu::Error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){};
+  fu::OnSuccessCallback onSuccess = [&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response> response){
+    responses.push_back(response->slices().front().copyString());
+  };
+
+  connection->sendRequest(fu::createRequest(fu::RestVerb::Get, "/first"), onError, onSuccess);
+  fu::run();
+
+  // the reconnect resumes the session of the first connection
+  server._dropNext = true;
+  connection->sendRequest(fu::createRequest(fu::RestVerb::Get, "/second"), onError, onSuccess);
+  fu::run();
+  ASSERT_EQ(responses, (std::vector<std::string>{"/first", "/second"}));
+  ASSERT_EQ(server._connections.load(), 2);
+  ASSERT_EQ(server._resumedSessions.load(), 1);
+  ASSERT_EQ(connection->requestsLeft(), 0u);
+}
+
+TEST(VstLoopback, Authentication){
+  LoopbackVstServer server;
+  fu::ConnectionBuilder builder;
+  builder.host(server.url());
+  fu::OnErrorCallback onError = [](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+    ADD_FAILURE() << fu::to_string(fu::intToError(error));
+  };
+  std::size_t ok = 0;
+  fu::OnSuccessCallback onSuccess = [&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){ ++ok; };
+
+  // no credentials - no authentication message
+  auto anonymous = builder.connect();
+  anonymous->sendRequest(echoRequest(10), onError, onSuccess);
+  fu::run();
+  ASSERT_EQ(ok, 1u);
+  ASSERT_TRUE(server.users().empty());
+
+  // every connection authenticates before its requests
+  builder.user("alice").password("secret");
+  auto connection = builder.connect();
+  connection->sendRequest(echoRequest(10), onError, onSuccess);
+  fu::run();
+  server._dropNext = true;
+  connection->sendRequest(fu::createRequest(fu::RestVerb::Get, "/_api/version"), onError, onSuccess);
+  fu::run();
+  ASSERT_EQ(ok, 3u);
+  ASSERT_EQ(server.users(), (std::vector<std::string>{"alice", "alice"}));
+  ASSERT_EQ(server._connections.load(), 3);
+}
+
+TEST(VstLoopback, AuthenticationRejected){
+  LoopbackVstServer server;
+  server._authResponseCode = 401;
+  fu::ConnectionBuilder builder;
+  builder.host(server.url()).user("alice").password("wrong");
+  auto connection = builder.connect();
+
+  std::vector<fu::Error> errors;
+  fu::OnErrorCallback onError = [&](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+    errors.push_back(error);
+  };
+  fu::OnSuccessCallback onSuccess = [](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+    ADD_FAILURE() << "request succeeded on a rejected connection";
+  };
+
+  // the server delays the requests behind the authentication message -
+  // their responses are not accepted
+  server._delay = 50;
+  connection->sendRequest(echoRequest(10), onError, onSuccess);
+  connection->sendRequest(echoRequest(20), onError, onSuccess);
+  fu::run();
+  auto unauthorized = fu::errorToInt(fu::ErrorCondition::VstUnauthorized);
+  ASSERT_EQ(errors, (std::vector<fu::Error>{unauthorized, unauthorized}));
+  ASSERT_EQ(connection->requestsLeft(), 0u);
+
+  // the next request connects and authenticates again
+  server._delay = 0;
+  server._authResponseCode = 200;
+  std::size_t ok = 0;
+  connection->sendRequest(echoRequest(10), onError
+                         ,[&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){ ++ok; });
+  fu::run();
+  ASSERT_EQ(ok, 1u);
+  ASSERT_EQ(errors.size(), 2u);
+  ASSERT_EQ(server._connections.load(), 2);
+  ASSERT_EQ(server.users(), (std::vector<std::string>{"alice", "alice"}));
+}
+
+TEST(VstLoopback, MaxMessageSize){
+  LoopbackVstServer server;
+  fu::ConnectionBuilder builder;
+  builder.host(server.url()).maxMessageSize(1000);
+  auto connection = builder.connect();
+
+  std::vector<fu::Error> errors;
+  std::vector<std::string> responses;
+  fu::OnErrorCallback onError = [&](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+    errors.push_back(error);
+  };
+  fu::OnSuccessCallback onSuccess = [&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response> response){
+    responses.push_back(response->slices().front().copyString());
+  };
+
+  // larger messages fail on their own - the buffer of a multi chunk message
+  // is not allocated and the connection is kept
+  connection->sendRequest(echoRequest(5000), onError, onSuccess);
+  fu::run();
+  server._responseChunkSize = 100;
+  connection->sendRequest(echoRequest(5000), onError, onSuccess);
+  connection->sendRequest(echoRequest(10), onError, onSuccess);
+  fu::run();
+  ASSERT_EQ(errors, std::vector<fu::Error>(2, fu::errorToInt(fu::ErrorCondition::VstReadError)));
+  ASSERT_EQ(responses, std::vector<std::string>{echoed(10)});
+
+  // the receive buffer does not grow for a larger chunk - it can not be
+  // skipped, so the connection is reset
+  server._responseChunkSize = 1024 * 1024;
+  connection->sendRequest(echoRequest(200000), onError, onSuccess);
+  fu::run();
+  ASSERT_EQ(errors.size(), 3u);
+  ASSERT_EQ(errors.back(), fu::errorToInt(fu::ErrorCondition::VstCanceldDuringReset));
+  connection->sendRequest(echoRequest(20), onError, onSuccess);
+  fu::run();
+  ASSERT_EQ(responses.back(), echoed(20));
+  ASSERT_EQ(server._connections.load(), 2);
+  ASSERT_EQ(connection->requestsLeft(), 0u);
+}
+
+TEST(VstLoopback, StreamedResponse){
+  LoopbackVstServer server;
+  server._responseChunkSize = 40; // the message header spans chunks
+  for(auto version : {fu::VstVersion::V1_0, fu::VstVersion::V1_1}){
+    fu::ConnectionBuilder builder;
+    builder.host(server.url()).vstVersion(version);
+    auto connection = builder.connect();
+
+    for(std::size_t length : {0u, 10u, 50u, 5000u}){
+      std::string streamed;
+      std::size_t parts = 0, ok = 0;
+      auto request = echoRequest(length);
+      request->onChunk([&](fu::MessageID, uint8_t const* data, std::size_t size){
+        // every call covers at most the payload of a single chunk
+        EXPECT_LE(size, server._responseChunkSize - 16);
+        streamed.append(reinterpret_cast<char const*>(data), size);
+        ++parts;
+      });
+      connection->sendRequest(std::move(request)
+                             ,[](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+                                ADD_FAILURE() << fu::to_string(fu::intToError(error));
+                              }
+                             ,[&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response> response){
+                                // the body has been handed to the chunk callback
+                                EXPECT_EQ(response->header.responseCode.get(), 200u);
+                                EXPECT_EQ(response->payload().second, 0u);
+                                ++ok;
+                              });
+      fu::run();
+      ASSERT_EQ(ok, 1u);
+      fu::VSlice body(reinterpret_cast<uint8_t const*>(streamed.data()));
+      ASSERT_EQ(body.byteSize(), streamed.size());
+      ASSERT_EQ(body.copyString(), echoed(length));
+      if(length == 5000){
+        ASSERT_GT(parts, 100u);
+      }
+    }
+    ASSERT_EQ(connection->requestsLeft(), 0u);
+  }
+}
+
+TEST(VstLoopback, StreamedResponseReset){
+  LoopbackVstServer server;
+  server._responseChunkSize = 100;
+  fu::ConnectionBuilder builder;
+  builder.host(server.url());
+  auto connection = builder.connect();
+
+  std::vector<fu::Error> errors;
+  std::vector<std::string> responses;
+  fu::OnErrorCallback onError = [&](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+    errors.push_back(error);
+  };
+  fu::OnSuccessCallback onSuccess = [&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response> response){
+    responses.push_back(response->slices().front().copyString());
+  };
+
+  // an idempotent request that streamed part of its body is not sent again -
+  // the callback would get the body a second time
+  server._truncateNext = true;
+  std::string streamed;
+  auto request = echoRequest(5000);
+  request->idempotent(true);
+  request->onChunk([&](fu::MessageID, uint8_t const* data, std::size_t size){
+    streamed.append(reinterpret_cast<char const*>(data), size);
+  });
+  connection->sendRequest(std::move(request), onError, onSuccess);
+  fu::run();
+  ASSERT_EQ(errors, std::vector<fu::Error>{fu::errorToInt(fu::ErrorCondition::VstCanceldDuringReset)});
+  ASSERT_GT(streamed.size(), 0u);
+  ASSERT_LT(streamed.size(), 5000u);
+
+  // a request that assembles its response is sent again
+  server._truncateNext = true;
+  request = echoRequest(5000);
+  request->idempotent(true);
+  connection->sendRequest(std::move(request), onError, onSuccess);
+  fu::run();
+  ASSERT_EQ(responses, std::vector<std::string>{echoed(5000)});
+  ASSERT_EQ(errors.size(), 1u);
+  ASSERT_EQ(connection->requestsLeft(), 0u);
+}
+
+TEST(VstLoopback, ShuffledResponseChunks){
+  LoopbackVstServer server;
+  server._responseChunkSize = 100;
+  server._shuffleChunks = true; // the first chunk is not always first
+  for(auto version : {fu::VstVersion::V1_0, fu::VstVersion::V1_1}){
+    fu::ConnectionBuilder builder;
+    builder.host(server.url()).vstVersion(version);
+    auto connection = builder.connect();
+
+    std::multiset<std::string> expected, responses;
+    std::size_t errors = 0;
+    for(std::size_t length : {0u, 10u, 90u, 300u, 5000u, 100000u}){
+      expected.insert(echoed(length));
+      connection->sendRequest(echoRequest(length)
+                             ,[&](fu::Error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){ ++errors; }
+                             ,[&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response> response){
+                                responses.insert(response->slices().front().copyString());
+                              });
+    }
+    fu::run();
+    ASSERT_EQ(errors, 0u);
+    ASSERT_EQ(responses, expected);
+    ASSERT_EQ(connection->requestsLeft(), 0u);
+  }
+}
+
+TEST(VstLoopback, Backpressure){
+  LoopbackVstServer server;
+  server._delay = 20;
+  LoopThreads loop;
+  for(auto policy : {fu::BackpressurePolicy::Fail, fu::BackpressurePolicy::Notify, fu::BackpressurePolicy::Block}){
+    std::atomic<int> ready(0), ok(0), full(0), other(0);
+    std::atomic<int> maxInFlight(0);
+    fu::ConnectionBuilder builder;
+    builder.host(server.url()).maxInFlight(4, 100000).backpressure(policy, [&]{ ++ready; });
+    auto connection = builder.connect();
+
+    int const count = 20;
+    for(int i = 0; i < count; ++i){
+      connection->sendRequest(echoRequest(10)
+                             ,[&](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+                                if(error == fu::errorToInt(fu::ErrorCondition::QueueFull)){
+                                  ++full;
+                                } else {
+                                  ++other;
+                                }
+                              }
+                             ,[&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){ ++ok; });
+      // a request leaves the store before its room is released - the
+      // store never holds more requests than the limit
+      maxInFlight = std::max<int>(maxInFlight, connection->requestsLeft());
+    }
+    ASSERT_TRUE(waitFor([&]{ return ok + full + other == count; }));
+    ASSERT_EQ(other.load(), 0);
+    if(policy == fu::BackpressurePolicy::Block){
+      // the caller waits for room
+      ASSERT_EQ(ok.load(), count);
+    } else {
+      ASSERT_EQ(ok.load(), 4);
+      ASSERT_EQ(full.load(), count - 4);
+    }
+    ASSERT_LE(maxInFlight.load(), 4);
+    ASSERT_TRUE(waitFor([&]{ return ready == (policy == fu::BackpressurePolicy::Notify ? 1 : 0); }));
+    ASSERT_EQ(connection->requestsLeft(), 0u);
+  }
+}
+
+TEST(VstLoopback, BackpressureBytes){
+  LoopbackVstServer server;
+  server._delay = 20;
+  LoopThreads loop;
+  fu::ConnectionBuilder builder;
+  builder.host(server.url()).maxInFlight(0, 5000).backpressure(fu::BackpressurePolicy::Fail);
+  auto connection = builder.connect();
+
+  // two encoded requests of 2000 bytes fit into the limit, a third does not
+  std::atomic<int> ok(0), full(0);
+  for(int i = 0; i < 5; ++i){
+    connection->sendRequest(echoRequest(2000)
+                           ,[&](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+                              EXPECT_EQ(error, fu::errorToInt(fu::ErrorCondition::QueueFull));
+                              ++full;
+                            }
+                           ,[&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){ ++ok; });
+  }
+  ASSERT_TRUE(waitFor([&]{ return ok + full == 5; }));
+  ASSERT_EQ(ok.load(), 2);
+  ASSERT_EQ(full.load(), 3);
+
+  // a request larger than the limit is sent when nothing else is in flight
+  std::atomic<int> large(0);
+  connection->sendRequest(echoRequest(10000)
+                         ,[](fu::Error error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){
+                            ADD_FAILURE() << fu::to_string(fu::intToError(error));
+                          }
+                         ,[&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){ ++large; });
+  ASSERT_TRUE(waitFor([&]{ return large == 1; }));
+}
+
+TEST(VstLoopback, AdaptiveInFlight){
+  LoopbackVstServer server;
+  server._delay = 50;
+  LoopThreads loop;
+  fu::ConnectionBuilder builder;
+  builder.host(server.url()).adaptiveInFlight(true).maxInFlight(16).backpressure(fu::BackpressurePolicy::Block);
+  auto connection = builder.connect();
+
+  // the limit starts at the configured maximum - no request waits for room
+  std::atomic<int> ok(0), failed(0);
+  for(int i = 0; i < 16; ++i){
+    connection->sendRequest(echoRequest(10)
+                           ,[&](fu::Error, std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){ ++failed; }
+                           ,[&](std::unique_ptr<fu::Request>, std::unique_ptr<fu::Response>){ ++ok; });
+  }
+  ASSERT_EQ(ok.load(), 0);
+  ASSERT_EQ(connection->requestsLeft(), 16u);
+  ASSERT_TRUE(waitFor([&]{ return ok + failed == 16; }));
+  ASSERT_EQ(failed.load(), 0);
+}